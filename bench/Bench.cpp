@@ -0,0 +1,225 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Book.hpp"
+#include "Scanner.hpp"
+
+/**
+ * Micro-benchmarks of the parsing hot paths. Nothing is sent over the
+ * network: the inputs are generated in memory, so the numbers only depend
+ * on the CPU. Run with "make bench"
+ */
+
+using Clock = std::chrono::steady_clock;
+
+// The results of the runs end here, so they aren't optimised away
+volatile size_t sink;
+
+/**
+ * @brief Run a function many times, and print how long a run took
+ * @param name What is measured
+ * @param runs How many times it is run
+ * @param bytes How many bytes a run processes
+ * @param work The function
+ */
+void measure(const std::string& name, const size_t runs, const size_t bytes,
+             const std::function<size_t()>& work) {
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < runs; i++) {
+        sink = work();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cout << name << ": " << elapsed * 1000 / runs << " ms per run, "
+              << (lint)(bytes * runs / elapsed / (1 << 20)) << " MB/s\n";
+}
+
+/**
+ * @brief Index the headers of a mix of responses, like the ones of the
+ * server (an answer to a read, a login that sets a cookie, a 304, an error
+ * page, a header with many cookies...), with the scalar scanner and with the
+ * widest one. Every header is followed by the start of its body, like in the
+ * buffer of a response, and they are scanned one after the other, so their
+ * lengths and the positions of their lines vary from one scan to the next
+ */
+void bench_header() {
+    const std::string common =
+        "X-Powered-By: Express" ENDL
+        "Date: Sun, 18 Oct 2026 12:00:00 GMT" ENDL
+        "Connection: keep-alive" ENDL
+        "Keep-Alive: timeout=5" ENDL;
+
+    std::vector<std::string> responses;
+    responses.push_back("HTTP/1.1 200 OK" ENDL + common +
+                        "Content-Type: application/json; charset=utf-8" ENDL
+                        "Content-Length: 121" ENDL
+                        "ETag: W/\"79-kB7fFYtZC5x3Xnh2N0Jt0wFxQkY\"" ENDL
+                        HEADER_TERMINATOR
+                        "[{\"id\":1,\"title\":\"Dune\"},{\"id\":2,"
+                        "\"title\":\"Emma\"}]");
+    responses.push_back(
+        "HTTP/1.1 200 OK" ENDL + common +
+        "Content-Type: text/plain; charset=utf-8" ENDL
+        "Content-Length: 2" ENDL
+        "Set-Cookie: connect.sid=s%3AJ5Ptlw3UYqQ2mbS3eLgIcI0v1N8fQ2Ft."
+        "M8wQb5SCl9sPNXAKGfAf7oD5l0XGcBw5yq2H5Hn1i2Y; Path=/; HttpOnly" ENDL
+        "Vary: Accept-Encoding" ENDL HEADER_TERMINATOR "OK");
+    responses.push_back("HTTP/1.1 304 Not Modified" ENDL + common +
+                        "ETag: W/\"79-kB7fFYtZC5x3Xnh2N0Jt0wFxQkY\"" ENDL
+                        HEADER_TERMINATOR);
+    responses.push_back("HTTP/1.1 204 No Content" ENDL
+                        "Date: Sun, 18 Oct 2026 12:00:00 GMT" ENDL
+                        HEADER_TERMINATOR);
+    responses.push_back("HTTP/1.1 404 Not Found" ENDL + common +
+                        "Content-Security-Policy: default-src 'none'" ENDL
+                        "X-Content-Type-Options: nosniff" ENDL
+                        "Content-Type: text/html; charset=utf-8" ENDL
+                        "Content-Length: 164" ENDL HEADER_TERMINATOR
+                        "<!DOCTYPE html><html lang=\"en\"><head><meta "
+                        "charset=\"utf-8\"><title>Error</title></head>");
+    responses.push_back(
+        "HTTP/1.1 200 OK" ENDL + common +
+        "Content-Type: application/json; charset=utf-8" ENDL
+        "Content-Length: 196" ENDL
+        "Cache-Control: private, max-age=30" ENDL HEADER_TERMINATOR
+        "{\"token\":\"eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJ1c2VySWQiOj"
+        "EsImlhdCI6MTYwMDAwMDAwMCwiZXhwIjoxNjAwMDAzNjAwfQ.c2lnbmF0dXJl\"}");
+
+    std::string cookies = "HTTP/1.1 200 OK" ENDL;
+    for (int i = 0; i < 16; i++) {
+        cookies += "Set-Cookie: cookie" + std::to_string(i) + "=" +
+                   std::string(8 + i * 5, 'x') + "; Path=/; HttpOnly" ENDL;
+    }
+    responses.push_back(cookies + "Content-Length: 0" HEADER_TERMINATOR);
+
+    // Only the headers are counted, as the scans stop at their end
+    size_t bytes = 0;
+    for (auto& response : responses) {
+        bytes += response.find(HEADER_TERMINATOR) + 4;
+    }
+
+    const size_t runs = 100000;
+    std::vector<size_t> lines;
+    lines.reserve(128);
+
+    measure("Headers, scalar", runs, bytes, [&]() {
+        size_t ends = 0;
+        for (auto& response : responses) {
+            lines.clear();
+            ends += scan_crlf_scalar(response.data(), 0, response.size(),
+                                     lines);
+        }
+        return ends;
+    });
+    measure("Headers, vectorized", runs, bytes, [&]() {
+        size_t ends = 0;
+        for (auto& response : responses) {
+            lines.clear();
+            ends += index_header(response.data(), response.size(), lines);
+        }
+        return ends;
+    });
+}
+
+/**
+ * @brief Parse a big listing (200k books, about 25 MB) with the json library
+ * and with the on-demand reader of the known shapes
+ */
+void bench_listing() {
+    std::string body = "[";
+    for (lint id = 1; id <= 200000; id++) {
+        Book book;
+        book.id = id;
+        book.title = "The book number " + std::to_string(id);
+        book.author = "Author " + std::to_string(id % 1000);
+        book.genre = "Genre " + std::to_string(id % 20);
+        book.publisher = "Publisher " + std::to_string(id % 100);
+        book.page_count = 100 + id % 900;
+        if (id != 1) {
+            body.push_back(',');
+        }
+        write_book(body, book, true);
+    }
+    body.push_back(']');
+
+    const size_t runs = 5;
+    measure("Listing, json::parse", runs, body.size(), [&]() {
+        std::vector<Book> books;
+        for (auto& elem : json::parse(body)) {
+            books.emplace_back();
+            book_from_json(elem, books.back());
+        }
+        return books.size();
+    });
+    measure("Listing, parse_books", runs, body.size(), [&]() {
+        std::vector<Book> books;
+        parse_books(body, books);
+        return books.size();
+    });
+}
+
+/**
+ * @brief Check that the parallel parse of a listing gives the same result
+ * as the sequential one, on valid and malformed listings. The arrays are
+ * split at every comma, so every element is on a split point
+ * @return true The results are the same
+ */
+bool check_listing() {
+    const std::string book = "{\"id\":1,\"title\":\"Dune\"}";
+    const std::vector<std::string> listings = {
+        "[]", "[ ]", "[" + book + "]", "[" + book + "," + book + "]",
+        "[" + book + ",]", "[," + book + "]", "[" + book + ",," + book + "]",
+        "[" + book + ", ," + book + "]", "[" + book + "," + book + ", ]",
+        "[,]", "[" + book + "," + book, "[" + book + "]]"};
+
+    bool same = true;
+    for (auto& listing : listings) {
+        std::vector<Book> sequential, parallel;
+        bool sequential_ok = parse_books(listing, sequential);
+        bool parallel_ok =
+            parse_book_list_parallel(listing, listing.size(), parallel);
+
+        std::string a, b;
+        for (auto& book : sequential) {
+            write_book(a, book, true);
+        }
+        for (auto& book : parallel) {
+            write_book(b, book, true);
+        }
+        if (sequential_ok != parallel_ok || (sequential_ok && a != b)) {
+            std::cout << "Listing " << listing
+                      << ": the parallel parse differs\n";
+            same = false;
+        }
+    }
+    std::cout << "Listing, parallel and sequential parses "
+              << (same ? "agree" : "differ") << " on " << listings.size()
+              << " listings\n";
+    return same;
+}
+
+int main() {
+    bool same = check_listing();
+    bench_header();
+    bench_listing();
+    return same ? 0 : 1;
+}
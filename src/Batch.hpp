@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Utils.hpp"
+
+/**
+ * @brief A command of a script, with its arguments on the same line
+ */
+struct BatchCommand {
+    // The line of the script (or the position of the argument)
+    lint line;
+    std::string name;
+    std::vector<std::string> args;
+};
+
+/**
+ * @brief Split a command line in words. The words are separated by spaces;
+ * a word in double quotes can hold spaces, and \" or \\ inside it
+ * @param text The line
+ * @param words Where the words are stored
+ * @return true The line is valid
+ * @return false A quote isn't closed
+ */
+bool split_command(std::string_view text, std::vector<std::string>& words) {
+    words.clear();
+    size_t i = 0;
+    FOREVER {
+        while (i < text.size() && std::isspace((uchar)text[i])) {
+            i++;
+        }
+        if (i == text.size()) {
+            return true;
+        }
+
+        std::string word;
+        bool quoted = false;
+        for (; i < text.size(); i++) {
+            char c = text[i];
+            if (quoted && c == '\\' && i + 1 < text.size() &&
+                (text[i + 1] == '"' || text[i + 1] == '\\')) {
+                word.push_back(text[++i]);
+            } else if (c == '"') {
+                quoted = !quoted;
+            } else if (!quoted && std::isspace((uchar)c)) {
+                break;
+            } else {
+                word.push_back(c);
+            }
+        }
+
+        if (quoted) {
+            return false;
+        }
+        words.push_back(std::move(word));
+    }
+}
+
+/**
+ * @brief Read a script: a command on every line. The empty lines and the
+ * ones starting with # are skipped
+ * @param in The script
+ * @param commands Where the commands are appended
+ * @param error Why the script is invalid
+ * @return true The script is valid
+ * @return false A line is malformed
+ */
+bool read_script(std::istream& in, std::vector<BatchCommand>& commands,
+                 std::string& error) {
+    std::string text;
+    std::vector<std::string> words;
+    lint line = 0;
+    while (std::getline(in, text)) {
+        line++;
+        if (!split_command(text, words)) {
+            error = "Line " + std::to_string(line) + ": unclosed quote";
+            return false;
+        }
+        if (words.size() == 0 || words[0][0] == '#') {
+            continue;
+        }
+
+        BatchCommand command;
+        command.line = line;
+        command.name = to_lower(words[0]);
+        command.args.assign(words.begin() + 1, words.end());
+        commands.push_back(std::move(command));
+    }
+    return true;
+}
+
+/**
+ * @brief Check if a command only reads the library. The reads that follow
+ * each other don't depend on each other, so they can run concurrently; any
+ * other command waits for the ones before it, and the ones after it wait
+ * for it
+ */
+bool is_read_command(const std::string& name) {
+    return name == "get_book" || name == "get_books" ||
+           name == "get_book_batch";
+}
@@ -0,0 +1,418 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "JsonReader.hpp"
+#include "JsonWriter.hpp"
+#include "ThreadPool.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief The schema of a book: FIELD(type, name, sent) for every field, where
+ * sent tells if the field is part of the body used to add a book. The struct,
+ * its encoder and its decoder are all generated from this list
+ */
+#define BOOK_FIELDS(FIELD)            \
+    FIELD(lint, id, false)            \
+    FIELD(std::string, title, true)   \
+    FIELD(std::string, author, true)  \
+    FIELD(std::string, genre, true)   \
+    FIELD(lint, page_count, true)     \
+    FIELD(std::string, publisher, true)
+
+/**
+ * @brief A book from the library
+ */
+struct Book {
+#define BOOK_MEMBER(type, name, sent) type name{};
+    BOOK_FIELDS(BOOK_MEMBER)
+#undef BOOK_MEMBER
+};
+
+/**
+ * @brief Write a book as the JSON body of an add_book request
+ * @param out The buffer where the object is appended
+ * @param book The book
+ * @param all_fields Also write the fields that aren't sent (like the id)
+ */
+void write_book(std::string& out, const Book& book,
+                const bool all_fields = false) {
+    JsonWriter writer(out);
+    writer.begin_object();
+#define BOOK_WRITE_FIELD(type, name, sent) \
+    if (sent || all_fields) {              \
+        writer.key(#name);                 \
+        writer.value(book.name);           \
+    }
+    BOOK_FIELDS(BOOK_WRITE_FIELD)
+#undef BOOK_WRITE_FIELD
+    writer.end_object();
+}
+
+bool read_book_field(JsonReader& reader, std::string& value) {
+    return reader.read_string(value);
+}
+
+bool read_book_field(JsonReader& reader, lint& value) {
+    // Older clients sent the numbers as strings
+    if (reader.peek() == '"') {
+        std::string_view text;
+        std::string scratch;
+        return reader.read_string(text, scratch) &&
+               parse_uint_field(text, value);
+    }
+    return reader.read_uint(value);
+}
+
+bool parse_book_field(std::string_view text, std::string& value) {
+    value.assign(text);
+    return true;
+}
+
+bool parse_book_field(std::string_view text, lint& value) {
+    return parse_uint_field(text, value);
+}
+
+/**
+ * @brief Set a field of a book from its text (like a column of a CSV file)
+ * @param book The book
+ * @param name The name of the field
+ * @param text The value
+ * @return true The field was set
+ * @return false The field isn't part of the schema, or the value is invalid
+ */
+bool set_book_field(Book& book, std::string_view name, std::string_view text) {
+#define BOOK_SET_FIELD(type, field, sent)          \
+    if (name == #field) {                          \
+        return parse_book_field(text, book.field); \
+    }
+    BOOK_FIELDS(BOOK_SET_FIELD)
+#undef BOOK_SET_FIELD
+    return false;
+}
+
+/**
+ * @brief Read a book object. The fields are matched directly against the
+ * schema, and the ones that aren't part of it are skipped
+ * @param reader The reader, positioned before the object
+ * @param book Where the fields are stored
+ * @return true The object matched the schema
+ * @return false The input isn't a book
+ */
+bool read_book(JsonReader& reader, Book& book) {
+    if (!reader.consume('{')) {
+        return false;
+    }
+    if (reader.consume('}')) {
+        return true;
+    }
+
+    std::string_view key;
+    std::string scratch;
+    do {
+        if (!reader.read_string(key, scratch) || !reader.consume(':')) {
+            return false;
+        }
+
+        bool known = false;
+#define BOOK_READ_FIELD(type, name, sent)                     \
+    if (!known && key == #name) {                             \
+        known = true;                                         \
+        if (!read_book_field(reader, book.name)) {            \
+            return false;                                     \
+        }                                                     \
+    }
+        BOOK_FIELDS(BOOK_READ_FIELD)
+#undef BOOK_READ_FIELD
+
+        if (!known && !reader.skip_value()) {
+            return false;
+        }
+    } while (reader.consume(','));
+
+    return reader.consume('}');
+}
+
+/**
+ * @brief Decode a body with books: either an array of book objects, or a
+ * single one
+ * @param text The body
+ * @param books Where the books are appended
+ */
+bool read_books(std::string_view text, std::vector<Book>& books) {
+    JsonReader reader(text);
+    if (reader.peek() == '{') {
+        books.emplace_back();
+        return read_book(reader, books.back()) && reader.at_end();
+    }
+
+    if (!reader.consume('[')) {
+        return false;
+    }
+    if (!reader.consume(']')) {
+        do {
+            books.emplace_back();
+            if (!read_book(reader, books.back())) {
+                return false;
+            }
+        } while (reader.consume(','));
+
+        if (!reader.consume(']')) {
+            return false;
+        }
+    }
+    return reader.at_end();
+}
+
+void book_field_from_json(const json& field, std::string& value) {
+    value = field.is_string() ? field.get<std::string>() : field.dump();
+}
+
+void book_field_from_json(const json& field, lint& value) {
+    if (field.is_number_unsigned()) {
+        value = field.get<lint>();
+    } else if (field.is_string()) {
+        parse_uint_field(field.get<std::string>(), value);
+    }
+}
+
+/**
+ * @brief Fill a book from a json DOM. This is the fallback for the bodies
+ * that don't have the expected shape, so it accepts any field types
+ * @param data The json object
+ * @param book Where the fields are stored
+ * @return true The data is an object
+ * @return false The data isn't a book
+ */
+bool book_from_json(const json& data, Book& book) {
+    if (!data.is_object()) {
+        return false;
+    }
+
+#define BOOK_FROM_JSON(type, name, sent)                   \
+    if (data.contains(#name) && !data[#name].is_null()) {  \
+        book_field_from_json(data[#name], book.name);      \
+    }
+    BOOK_FIELDS(BOOK_FROM_JSON)
+#undef BOOK_FROM_JSON
+    return true;
+}
+
+/**
+ * @brief Build the json DOM of a book, with all its fields
+ */
+json book_to_json(const Book& book) {
+    json data = json::object();
+#define BOOK_TO_JSON(type, name, sent) data[#name] = book.name;
+    BOOK_FIELDS(BOOK_TO_JSON)
+#undef BOOK_TO_JSON
+    return data;
+}
+
+/**
+ * @brief Parse a single book (an element of a listing). Anything the fast
+ * decoder doesn't expect is left to the json library
+ * @param text The JSON object
+ * @param book Where the fields are stored
+ */
+bool parse_book(std::string_view text, Book& book) {
+    JsonReader reader(text);
+    if (read_book(reader, book) && reader.at_end()) {
+        return true;
+    }
+
+    book = Book();
+    return book_from_json(json::parse(text, nullptr, false), book);
+}
+
+/**
+ * @brief Parse a body with books: either an array of book objects, or a
+ * single one. Anything the fast decoder doesn't expect is left to the json
+ * library
+ * @param text The body
+ * @param books Where the books are appended
+ */
+bool parse_books(std::string_view text, std::vector<Book>& books) {
+    const size_t first = books.size();
+    if (read_books(text, books)) {
+        return true;
+    }
+    books.resize(first);
+
+    json data = json::parse(text, nullptr, false);
+    if (data.is_object()) {
+        books.emplace_back();
+        return book_from_json(data, books.back());
+    } else if (!data.is_array()) {
+        return false;
+    }
+
+    for (auto& elem : data) {
+        books.emplace_back();
+        if (!book_from_json(elem, books.back())) {
+            books.resize(first);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Split a JSON array into (roughly equal) ranges of whole elements.
+ * Only the structural bytes are looked at, so this is much faster than
+ * parsing the elements
+ * @param text The array
+ * @param parts How many ranges should be made
+ * @param ranges The ranges (the elements, separated by commas, without the
+ * brackets)
+ * @return true The array was split
+ * @return false The text isn't a well-formed array (an empty element, or a
+ * trailing comma, is found where the array is split)
+ */
+bool split_array(std::string_view text, const size_t parts,
+                 std::vector<std::string_view>& ranges) {
+    const char* end = text.data() + text.size();
+    const size_t target = text.size() / std::max<size_t>(parts, 1) + 1;
+
+    JsonReader reader(text);
+    if (reader.peek() != '[') {
+        return false;
+    }
+    const char* pos = text.data() + text.find('[') + 1;
+
+    const char* start = pos;
+    uint depth = 1;
+    while (depth != 0) {
+        pos = find_structural(pos, end);
+        if (pos == end) {
+            return false;
+        }
+
+        const char c = *pos;
+        if (c == '"') {
+            pos = skip_string(pos + 1, end);
+            continue;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            depth--;
+        } else if (c == ',' && depth == 1 &&
+                   (size_t)(pos - start) >= target) {
+            std::string_view range(start, pos - start);
+            if (JsonReader(range).at_end()) {
+                return false;
+            }
+            ranges.push_back(range);
+            start = pos + 1;
+        }
+        pos++;
+    }
+
+    // The last range ends before the closing bracket. It can only be empty
+    // if the array is
+    std::string_view range(start, pos - 1 - start);
+    if (ranges.size() != 0 && JsonReader(range).at_end()) {
+        return false;
+    }
+    ranges.push_back(range);
+    return JsonReader(std::string_view(pos, end - pos)).at_end();
+}
+
+/**
+ * @brief Decode a range of book objects, separated by commas
+ * @param text The range
+ * @param books Where the books are appended
+ */
+bool read_book_range(std::string_view text, std::vector<Book>& books) {
+    JsonReader reader(text);
+    if (reader.at_end()) {
+        return true;
+    }
+
+    do {
+        books.emplace_back();
+        if (!read_book(reader, books.back())) {
+            return false;
+        }
+    } while (reader.consume(','));
+    return reader.at_end();
+}
+
+/**
+ * @brief Parse a listing of books on all the cores: the array is split into
+ * ranges of elements that are decoded in parallel, and then merged in order.
+ * The result is always the same as the one of parse_books
+ * @param text The body
+ * @param splits How many ranges the array is split into
+ * @param books Where the books are appended
+ */
+bool parse_book_list_parallel(std::string_view text, const size_t splits,
+                              std::vector<Book>& books) {
+    ThreadPool& pool = cpu_pool();
+    std::vector<std::string_view> ranges;
+    if (!split_array(text, splits, ranges)) {
+        return parse_books(text, books);
+    }
+
+    std::vector<std::vector<Book>> parts(ranges.size());
+    std::vector<std::future<bool>> results;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        results.push_back(pool.submit(
+            [&, i] { return read_book_range(ranges[i], parts[i]); }));
+    }
+
+    bool valid = true;
+    for (auto& result : results) {
+        valid = result.get() && valid;
+    }
+
+    // Anything unexpected is handled by the sequential parser
+    if (!valid) {
+        return parse_books(text, books);
+    }
+
+    size_t total = 0;
+    for (auto& part : parts) {
+        total += part.size();
+    }
+    books.reserve(books.size() + total);
+    for (auto& part : parts) {
+        std::move(part.begin(), part.end(), std::back_inserter(books));
+    }
+    return true;
+}
+
+/**
+ * @brief Parse a listing of books. Above PARALLEL_PARSE_THRESHOLD, it is
+ * parsed on all the cores
+ * @param text The body
+ * @param books Where the books are appended
+ */
+bool parse_book_list(std::string_view text, std::vector<Book>& books) {
+    size_t threads = cpu_pool().size();
+    if (PARALLEL_PARSE_THRESHOLD == 0 ||
+        text.size() < PARALLEL_PARSE_THRESHOLD || threads < 2) {
+        return parse_books(text, books);
+    }
+    return parse_book_list_parallel(text, threads * 4, books);
+}
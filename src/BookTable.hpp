@@ -0,0 +1,302 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Book.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief A set of distinct strings, each identified by a small code. Columns
+ * with few distinct values (authors, genres...) store only the codes
+ */
+class StringDictionary {
+   private:
+    // A deque never moves its elements, so the index can point into them
+    std::deque<std::string> values;
+    std::unordered_map<std::string_view, uint> index;
+
+    void rebuild_index() {
+        index.clear();
+        for (uint code = 0; code < values.size(); code++) {
+            index.emplace(values[code], code);
+        }
+    }
+
+   public:
+    StringDictionary() = default;
+    StringDictionary(StringDictionary&&) = default;
+    StringDictionary& operator=(StringDictionary&&) = default;
+
+    // A copy must point into its own values
+    StringDictionary(const StringDictionary& other) : values(other.values) {
+        rebuild_index();
+    }
+
+    StringDictionary& operator=(const StringDictionary& other) {
+        if (this != &other) {
+            values = other.values;
+            rebuild_index();
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Get the code of a string, adding it if it is new
+     */
+    uint encode(std::string_view value) {
+        auto it = index.find(value);
+        if (it != index.end()) {
+            return it->second;
+        }
+
+        values.emplace_back(value);
+        uint code = values.size() - 1;
+        index.emplace(values.back(), code);
+        return code;
+    }
+
+    std::string_view decode(const uint code) const { return values[code]; }
+
+    size_t size() const { return values.size(); }
+
+    void clear() {
+        index.clear();
+        values.clear();
+    }
+};
+
+/**
+ * @brief How a listing is shown: only the books whose title contains a text,
+ * sorted by id or by title (or in the order they were received)
+ */
+struct ListingQuery {
+    // "", "id" or "title"
+    std::string sort;
+    std::string title;
+
+    bool is_default() const { return sort == "" && title == ""; }
+};
+
+/**
+ * @brief Parse the arguments of get_books, like "sort=title title=Dune"
+ * @param args The arguments
+ * @param query Where the query is stored
+ * @return true The arguments are valid
+ * @return false An argument is unknown
+ */
+bool parse_listing_query(const std::vector<std::string>& args,
+                         ListingQuery& query) {
+    query = ListingQuery();
+    for (auto& arg : args) {
+        std::string_view word(arg);
+        if (word == "sort=id" || word == "sort=title") {
+            query.sort = word.substr(sizeof("sort=") - 1);
+        } else if (word.substr(0, sizeof("title=") - 1) == "title=") {
+            query.title = word.substr(sizeof("title=") - 1);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief A columnar table of books. Every field is stored in its own
+ * contiguous array: the titles share a single character arena, and the
+ * authors, genres and publishers are dictionary-encoded
+ */
+class BookTable {
+   private:
+    std::vector<lint> ids;
+    std::vector<lint> page_counts;
+
+    std::string title_arena;
+    std::vector<uint> title_start;
+    std::vector<uint> title_length;
+
+    StringDictionary dictionary;
+    std::vector<uint> authors;
+    std::vector<uint> genres;
+    std::vector<uint> publishers;
+
+   public:
+    size_t size() const { return ids.size(); }
+
+    /**
+     * @brief Add a book at the end of the table
+     */
+    void append(const Book& book) {
+        ids.push_back(book.id);
+        page_counts.push_back(book.page_count);
+
+        title_start.push_back(title_arena.size());
+        title_length.push_back(book.title.size());
+        title_arena.append(book.title);
+
+        authors.push_back(dictionary.encode(book.author));
+        genres.push_back(dictionary.encode(book.genre));
+        publishers.push_back(dictionary.encode(book.publisher));
+    }
+
+    /**
+     * @brief Remove a row. The title stays in the arena until the table is
+     * cleared
+     */
+    void erase(const size_t row) {
+        ids.erase(ids.begin() + row);
+        page_counts.erase(page_counts.begin() + row);
+        title_start.erase(title_start.begin() + row);
+        title_length.erase(title_length.begin() + row);
+        authors.erase(authors.begin() + row);
+        genres.erase(genres.begin() + row);
+        publishers.erase(publishers.begin() + row);
+    }
+
+    void clear() {
+        ids.clear();
+        page_counts.clear();
+        title_arena.clear();
+        title_start.clear();
+        title_length.clear();
+        dictionary.clear();
+        authors.clear();
+        genres.clear();
+        publishers.clear();
+    }
+
+    lint id(const size_t row) const { return ids[row]; }
+
+    lint page_count(const size_t row) const { return page_counts[row]; }
+
+    std::string_view title(const size_t row) const {
+        return std::string_view(title_arena).substr(title_start[row],
+                                                    title_length[row]);
+    }
+
+    std::string_view author(const size_t row) const {
+        return dictionary.decode(authors[row]);
+    }
+
+    std::string_view genre(const size_t row) const {
+        return dictionary.decode(genres[row]);
+    }
+
+    std::string_view publisher(const size_t row) const {
+        return dictionary.decode(publishers[row]);
+    }
+
+    /**
+     * @brief Build the book stored in a row
+     */
+    Book row(const size_t row) const {
+        Book book;
+        book.id = id(row);
+        book.title = title(row);
+        book.author = author(row);
+        book.genre = genre(row);
+        book.publisher = publisher(row);
+        book.page_count = page_count(row);
+        return book;
+    }
+
+    /**
+     * @brief Find the row of a book
+     * @param id The id of the book
+     * @return size_t The row, or size() if the book isn't in the table
+     */
+    size_t find(const lint id) const {
+        return std::find(ids.begin(), ids.end(), id) - ids.begin();
+    }
+
+    /**
+     * @brief Select the rows that match a condition
+     * @param matches Called with every row number
+     * @return std::vector<size_t> The matching rows, in table order
+     */
+    std::vector<size_t> select(
+        const std::function<bool(const BookTable&, size_t)>& matches) const {
+        std::vector<size_t> rows;
+        for (size_t row = 0; row < size(); row++) {
+            if (matches(*this, row)) {
+                rows.push_back(row);
+            }
+        }
+        return rows;
+    }
+
+    /**
+     * @brief Sort rows by id, without moving the data
+     * @param rows The rows (sorted in place)
+     */
+    void sort_by_id(std::vector<size_t>& rows) const {
+        std::sort(rows.begin(), rows.end(),
+                  [&](size_t a, size_t b) { return ids[a] < ids[b]; });
+    }
+
+    /**
+     * @brief Sort rows by title (and then by id, for equal titles)
+     * @param rows The rows (sorted in place)
+     */
+    void sort_by_title(std::vector<size_t>& rows) const {
+        std::sort(rows.begin(), rows.end(), [&](size_t a, size_t b) {
+            int order = title(a).compare(title(b));
+            return order != 0 ? order < 0 : ids[a] < ids[b];
+        });
+    }
+
+    /**
+     * @brief All the rows, in table order
+     */
+    std::vector<size_t> all() const {
+        std::vector<size_t> rows(size());
+        for (size_t row = 0; row < rows.size(); row++) {
+            rows[row] = row;
+        }
+        return rows;
+    }
+
+    /**
+     * @brief The rows of a listing, filtered and sorted like a query asks.
+     * Only the columns that are compared are read
+     * @param query The query
+     * @return std::vector<size_t> The rows, in the order they are shown
+     */
+    std::vector<size_t> rows(const ListingQuery& query) const {
+        std::vector<size_t> rows;
+        if (query.title == "") {
+            rows = all();
+        } else {
+            rows = select([&](const BookTable& table, size_t row) {
+                return table.title(row).find(query.title) !=
+                       std::string_view::npos;
+            });
+        }
+
+        if (query.sort == "id") {
+            sort_by_id(rows);
+        } else if (query.sort == "title") {
+            sort_by_title(rows);
+        }
+        return rows;
+    }
+};
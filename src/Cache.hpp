@@ -0,0 +1,269 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Response.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief A response stored in the cache
+ */
+struct CacheEntry {
+    std::string header;
+    std::string body;
+
+    // The validators used to revalidate the entry, once it is stale
+    std::string etag;
+    std::string last_modified;
+
+    size_t bytes() const {
+        return header.size() + body.size() + etag.size() +
+               last_modified.size();
+    }
+
+    bool can_revalidate() const {
+        return etag.size() != 0 || last_modified.size() != 0;
+    }
+};
+
+/**
+ * @brief The header of a response, as it is stored in the cache: without the
+ * cookies it set (they belong to the client that got it first), and without
+ * the fields that only describe the connection it came on
+ * @param r The response
+ * @return std::string The header
+ */
+std::string cached_header(const Response& r) {
+    std::string_view raw = r.get_raw_header();
+    std::string header;
+    header.reserve(raw.size());
+
+    std::size_t start = 0;
+    while (start < raw.size()) {
+        std::size_t end = raw.find(ENDL, start);
+        end = end == std::string_view::npos ? raw.size() : end + 2;
+        std::string_view line = raw.substr(start, end - start);
+        std::size_t colon = line.find(':');
+
+        // The status line, and the end of the header, are always kept
+        std::string name;
+        if (start != 0 && colon != std::string_view::npos) {
+            name = to_lower(trim_spaces(line.substr(0, colon)));
+        }
+        if (name != "set-cookie" && name != "connection" &&
+            name != "keep-alive" && name != "transfer-encoding") {
+            header.append(line);
+        }
+        start = end;
+    }
+    return header;
+}
+
+/**
+ * @brief How a response can be cached, according to its Cache-Control field
+ */
+struct CachePolicy {
+    bool store;
+    lint max_age;
+};
+
+/**
+ * @brief Read the caching policy of a response. Responses without a max-age
+ * are still stored if they can be revalidated, but they are stale from the
+ * start
+ * @param r The response
+ * @return CachePolicy The policy
+ */
+CachePolicy get_cache_policy(const Response& r) {
+    CachePolicy policy;
+    policy.store = r.get_header("ETag").size() != 0 ||
+                   r.get_header("Last-Modified").size() != 0;
+    policy.max_age = 0;
+
+    // The chunks of a body aren't decoded, so it can only be replayed on the
+    // connection it came on
+    if (r.get_header("Transfer-Encoding").size() != 0) {
+        policy.store = false;
+        return policy;
+    }
+
+    std::string_view directives = r.get_header("Cache-Control");
+    while (directives.size() != 0) {
+        std::size_t comma = directives.find(',');
+        std::string_view directive = directives.substr(0, comma);
+        directives = comma == std::string_view::npos
+                         ? std::string_view()
+                         : directives.substr(comma + 1);
+
+        std::size_t first = directive.find_first_not_of(' ');
+        if (first == std::string_view::npos) {
+            continue;
+        }
+        std::string name = to_lower(directive.substr(first));
+
+        // A response that must be checked on every use, or that belongs to
+        // a single user, isn't kept at all
+        if (name.compare(0, 8, "no-store") == 0 ||
+            name.compare(0, 8, "no-cache") == 0 ||
+            name.compare(0, 7, "private") == 0) {
+            policy.store = false;
+            return policy;
+        } else if (name.compare(0, 8, "max-age=") == 0 &&
+                   parse_uint_field(std::string_view(name).substr(8),
+                                    policy.max_age)) {
+            policy.store = true;
+        }
+    }
+
+    // So that it can't overflow once converted to a time point
+    policy.max_age = std::min<lint>(policy.max_age, MAX_CACHE_AGE);
+    return policy;
+}
+
+/**
+ * @brief A cache of GET responses, bounded by a budget of bytes. When it is
+ * full, the least recently used entries are evicted. It can be shared by
+ * many threads
+ */
+class ResponseCache {
+   public:
+    using Entry = std::shared_ptr<const CacheEntry>;
+    using Clock = std::chrono::steady_clock;
+
+   private:
+    struct Slot {
+        Entry entry;
+        size_t bytes;
+        Clock::time_point expires;
+        std::list<std::string>::iterator position;
+    };
+
+    size_t budget;
+    size_t used;
+
+    // The most recently used keys are at the front
+    std::list<std::string> order;
+    std::unordered_map<std::string, Slot> slots;
+    std::mutex mutex;
+
+    void remove(const std::string& key) {
+        auto it = slots.find(key);
+        if (it == slots.end()) {
+            return;
+        }
+        used -= it->second.bytes;
+        order.erase(it->second.position);
+        slots.erase(it);
+    }
+
+   public:
+    ResponseCache(const size_t budget) : budget(budget), used(0) {}
+
+    /**
+     * @brief Build the key of a request
+     * @param method The method (only GET responses are stored)
+     * @param url The url
+     * @param identity Who made the request (the credentials used)
+     */
+    static std::string key(const std::string& method, const std::string& url,
+                           const std::string& identity) {
+        return method + " " + url + " " + identity;
+    }
+
+    /**
+     * @brief Find an entry, and mark it as recently used
+     * @param key The key of the request
+     * @param fresh Set if the entry can be used without revalidating it
+     * @return Entry The entry, or nullptr
+     */
+    Entry lookup(const std::string& key, bool& fresh) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = slots.find(key);
+        if (it == slots.end()) {
+            fresh = false;
+            return nullptr;
+        }
+
+        order.splice(order.begin(), order, it->second.position);
+        fresh = Clock::now() < it->second.expires;
+        return it->second.entry;
+    }
+
+    /**
+     * @brief Store (or replace) an entry, evicting others if needed. Entries
+     * bigger than the whole budget aren't stored
+     * @param key The key of the request
+     * @param entry The response
+     * @param max_age For how many seconds the entry is fresh
+     */
+    void store(const std::string& key, CacheEntry entry, const lint max_age) {
+        std::lock_guard<std::mutex> lock(mutex);
+        remove(key);
+
+        size_t bytes = entry.bytes() + key.size();
+        if (bytes > budget) {
+            return;
+        }
+
+        while (used + bytes > budget && order.size() != 0) {
+            remove(order.back());
+        }
+
+        order.push_front(key);
+        used += bytes;
+
+        Slot& slot = slots[key];
+        slot.entry = std::make_shared<const CacheEntry>(std::move(entry));
+        slot.bytes = bytes;
+        slot.expires = Clock::now() + std::chrono::seconds(max_age);
+        slot.position = order.begin();
+    }
+
+    /**
+     * @brief Make an entry fresh again (the server said it wasn't modified)
+     * @param key The key of the request
+     * @param max_age For how many seconds the entry is fresh
+     */
+    void renew(const std::string& key, const lint max_age) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = slots.find(key);
+        if (it != slots.end()) {
+            it->second.expires = Clock::now() + std::chrono::seconds(max_age);
+        }
+    }
+
+    /**
+     * @brief Remove an entry (the resource was modified)
+     */
+    void invalidate(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        remove(key);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        slots.clear();
+        order.clear();
+        used = 0;
+    }
+};
@@ -24,20 +24,86 @@
 
 std::string require_params() {
     std::stringstream ss;
-    ss << "Wrong parameters : ./restcpp HOST PORT\n";
+    ss << "Wrong parameters : ./restcpp HOST PORT [--daemon | --proxy "
+          "LOCAL_PORT | -f SCRIPT | COMMAND...]\n";
     return ss.str();
 }
 
 int main(int argc, char **argv) {
-    MUST(argc == 3, require_params());
+    MUST(argc >= 3, require_params());
 
     std::string host = argv[1];
     uint port = atoi(argv[2]);
     MUST(port, require_params());
 
     using namespace RestCpp;
-    Client client(host, port);
-    client.run();
+    if (argc == 3) {
+        Client client(host, port);
+        client.run();
+        return 0;
+    }
+
+    if (std::string(argv[3]) == "--daemon") {
+        MUST(argc == 4, require_params());
+        std::string path = daemon_path(host, port);
+        MUST(path != "", "The daemon is disabled\n");
+
+        Client client(host, port);
+        client.serve(path);
+        return 0;
+    }
+
+    if (std::string(argv[3]) == "--proxy") {
+        MUST(argc == 5, require_params());
+        uint local_port = atoi(argv[4]);
+        MUST(local_port, require_params());
+
+        Endpoint endpoint(host, port);
+        ConnectionPool pool(endpoint, BULK_CONCURRENCY);
+        ResponseCache cache(CACHE_BUDGET);
+        ReverseProxy proxy(endpoint, pool, cache);
+        proxy.serve(local_port);
+        return 0;
+    }
+
+    // The commands of a batch come from a script ("-" for stdin), or from
+    // the arguments, one command in each
+    std::string script;
+    if (std::string(argv[3]) == "-f") {
+        MUST(argc == 5, require_params());
 
-    return 0;
-}
\ No newline at end of file
+        std::ifstream file;
+        if (std::string(argv[4]) != "-") {
+            file.open(argv[4]);
+            MUST(file, "Couldn't open " << argv[4] << "\n");
+        }
+        std::istream &in = file.is_open() ? file : std::cin;
+        std::stringstream text;
+        text << in.rdbuf();
+        script = text.str();
+    } else {
+        for (int i = 3; i < argc; i++) {
+            script.append(argv[i]).push_back('\n');
+        }
+    }
+
+    std::vector<BatchCommand> commands;
+    std::string error;
+    std::istringstream in(script);
+    MUST(read_script(in, commands, error), error << "\n");
+
+    // A script without commands has nothing to run (and no result to wait
+    // for)
+    if (commands.size() == 0) {
+        return 0;
+    }
+
+    // A running daemon runs the batch, with its warm session; otherwise it
+    // is run here
+    int status = 0;
+    if (forward_script(daemon_path(host, port), script, status)) {
+        return status;
+    }
+    Client client(host, port);
+    return client.run_batch(commands) ? 0 : 1;
+}
@@ -22,134 +22,370 @@
 
 #pragma once
 
+#include "Batch.hpp"
+#include "Book.hpp"
+#include "BookTable.hpp"
+#include "Cache.hpp"
+#include "Connection.hpp"
+#include "ConnectionPool.hpp"
+#include "Credentials.hpp"
+#include "Daemon.hpp"
+#include "Export.hpp"
+#include "Import.hpp"
+#include "Journal.hpp"
+#include "Library.hpp"
+#include "Proxy.hpp"
+#include "Snapshot.hpp"
+#include "JsonStream.hpp"
 #include "Request.hpp"
 #include "Response.hpp"
+#include "SingleFlight.hpp"
+#include "ThreadPool.hpp"
+#include "TokenRefresher.hpp"
 #include "Utils.hpp"
 
 namespace RestCpp {
+/**
+ * @brief A book fetched or added by a bulk request
+ */
+struct BookResult {
+    uint id;
+
+    // The response code (0 if nothing was received)
+    uint code;
+    Book book;
+
+    // Why the book couldn't be fetched ("" if it was)
+    std::string error;
+
+    // The header of the response, if it sets cookies
+    std::string cookie_header;
+
+    bool ok() const { return is_code_success(code) && error == ""; }
+};
+
+/**
+ * @brief The listing of the library (the books only have their ids and
+ * titles), shared by the reads that asked for it at the same time
+ */
+struct ListingResult {
+    // The response code (0 if nothing was received)
+    uint code;
+    std::vector<Book> books;
+
+    // Why the listing couldn't be received ("" if it was)
+    std::string error;
+
+    // The header of the response, if it sets cookies
+    std::string cookie_header;
+
+    bool ok() const { return is_code_success(code) && error == ""; }
+};
+
 class Client {
    private:
-    int sockfd;
     int port;
-    sockaddr_in serv_addr;
     std::string host;
 
-    // The session id cookie
-    Cookie session_id;
-    std::string library_token;
+    // The address of the server, resolved once
+    Endpoint endpoint;
 
-    /**
-     * @brief Send a HTTP request to the server
-     * @param sockfd The connection socket
-     * @param message The request
-     */
-    void send_to_server(const std::string& message) const {
-        int bytes, sent = 0;
-        int total = message.size();
+    // The connection of the current command (taken from the pool), if it
+    // was used before, the request that was sent on it, and if the whole
+    // request was sent
+    std::unique_ptr<Connection> connection;
+    bool connection_reused;
+    std::string sent_request;
+    bool request_sent;
 
-        do {
-            bytes = write(sockfd, message.c_str() + sent, total - sent);
-            CERR(bytes < 0);
+    // The session id cookie, the JWT of the library, and the user that
+    // logged in (who owns the library snapshots). The requests are built
+    // from a snapshot of them, that is only ever replaced as a whole
+    SharedCredentials credentials;
 
-            if (bytes == 0) {
-                break;
-            }
+    // If the credentials were saved by a previous run
+    std::atomic<bool> restored;
 
-            sent += bytes;
-        } while (sent < total);
-    }
+    // The credentials that were last written in the file
+    SharedCredentials::Snapshot saved_credentials;
 
-    /**
-     * @brief Receive a HTTP response from the server
-     * @param sockfd The connection socket
-     * @return std::string The response
-     */
-    std::string receive_from_server() const {
-        std::stringstream ss;
-        // There is another byte at the end to be sure the buffer is always
-        // null-terminated
-        char response[BUFLEN + 1];
-        int content_length = 0;
-        int header_end = 0;
+    // The local copy of the library
+    LocalLibrary library;
 
-        // Here the header is read
-        do {
-            bzero(response, BUFLEN + 1);
-            int bytes = read(sockfd, response, BUFLEN);
-            CERR(bytes < 0);
+    // A listing requested in the background, to replace the snapshot
+    std::future<std::unique_ptr<BookTable>> reconciling;
+    lint reconcile_epoch;
 
-            if (bytes == 0) {
-                break;
-            }
+    // The GET responses that can be reused
+    ResponseCache cache;
 
-            ss << response;
+    // Replaces the token of the library before it expires
+    TokenRefresher refresher;
 
-            // Check if we received all the header data
-            // Search for the CONTENT-LENGTH
-            header_end = ss.str().find(HEADER_TERMINATOR);
+    // If the bulk commands show their progress (not in a batch, where the
+    // output is read by a program)
+    bool show_progress;
 
-            if (header_end >= 0) {
-                header_end += sizeof(HEADER_TERMINATOR) - 1;
+    // If the client runs as a daemon, so a batch doesn't end the session
+    bool resident;
 
-                int clen_start = ss.str().find("Content-Length: ");
+    // Persistent connections, and the threads that use them, for the bulk
+    // commands (the threads are started by the first bulk command, and more
+    // are started if a command needs a larger window)
+    ConnectionPool pool;
+    std::unique_ptr<ThreadPool> io_pool;
 
-                if (clen_start < 0) {
-                    continue;
-                }
+    // The reads in flight on the I/O threads, keyed by their requests (the
+    // method, the url and the credentials), so identical reads that overlap
+    // are sent once and share the parsed result
+    SingleFlight<BookResult> book_flights;
+    SingleFlight<std::shared_ptr<const ListingResult>> listing_flights;
 
-                clen_start += sizeof("Content-Length: ") - 1;
-                int clen_size = ss.str().find(ENDL, clen_start) - clen_start;
+    // The first connection, opened in the background at startup
+    std::future<void> preconnecting;
 
-                // Extract content lenght (the number) from the field
-                content_length =
-                    atoi(ss.str().substr(clen_start, clen_size).c_str());
-                break;
+    // Where the commands print their results and their errors: the standard
+    // streams, or the buffers of a batch command (the background threads
+    // only ever print on the standard streams)
+    std::ostream* out_stream;
+    std::ostream* err_stream;
+
+    /**
+     * @brief The credentials used for the requests, which are part of the
+     * cache keys
+     */
+    static std::string identity(const Credentials& auth) {
+        return auth.session_id() + " " + auth.token;
+    }
+
+    /**
+     * @brief The Cookie line of a request (rendered once by the cookie jar,
+     * and reused until the cookies change)
+     * @param auth The credentials
+     * @param url The url of the request
+     */
+    std::string cookie_line(const Credentials& auth,
+                            const std::string& url) const {
+        return auth.cookies.header(host, url, false, unix_now());
+    }
+
+    /**
+     * @brief Keep the cookies set by a response
+     * @param r The response
+     * @param url The url of the request
+     */
+    void keep_cookies(const Response& r, const std::string& url) {
+        if (r.get_headers("Set-Cookie").size() == 0) {
+            return;
+        }
+
+        Credentials next = *credentials.load();
+        r.store_cookies(next.cookies, host, url);
+        store_credentials(next);
+    }
+
+    /**
+     * @brief Execute a GET request through the response cache. Fresh entries
+     * are used without contacting the server, and stale ones are revalidated
+     * (a 304 means the stored body can be used). The body of a successful
+     * response is passed on in chunks, like in receive_streamed, no matter
+     * where it comes from
+     * @param url The url
+     * @param on_header Called once the header of a successful response is
+     * known, before its body
+     * @param on_body Called for every chunk of a successful body
+     * @return Response The response (without the body, if it was successful)
+     */
+    Response cached_get(const std::string& url,
+                        const std::function<void(const Response&)>& on_header,
+                        const BodyHandler& on_body) {
+        SharedCredentials::Snapshot auth = credentials.load();
+        std::string key = ResponseCache::key("GET", url, identity(*auth));
+        bool fresh = false;
+        ResponseCache::Entry entry = nullptr;
+        if (CACHE_BUDGET != 0) {
+            entry = cache.lookup(key, fresh);
+        }
+
+        auto replay = [&]() {
+            Response r(entry->header);
+            if (on_header) {
+                on_header(r);
             }
+            if (entry->body.size() != 0) {
+                on_body(entry->body.data(), entry->body.size());
+            }
+            return r;
+        };
+
+        if (entry && fresh) {
+            return replay();
         }
-        FOREVER;
 
-        size_t total = content_length + (size_t)header_end;
+        std::vector<KeyValue> validators;
+        if (entry && entry->etag.size() != 0) {
+            validators.push_back(KeyValue("If-None-Match", entry->etag));
+        }
+        if (entry && entry->last_modified.size() != 0) {
+            validators.push_back(
+                KeyValue("If-Modified-Since", entry->last_modified));
+        }
 
-        // Receive the DATA contained
-        while (ss.str().size() < total) {
-            bzero(response, BUFLEN + 1);
-            int bytes = read(sockfd, response, BUFLEN);
+        connect_to_server();
+        send_to_server(create_get_request(host, url, "",
+                                          cookie_line(*auth, url), auth->token,
+                                          validators));
+
+        // The body is kept as it arrives, if the response can be cached
+        CacheEntry received;
+        CachePolicy policy;
+        policy.store = false;
+        Response r = receive_streamed(
+            [&](const Response& header) {
+                policy = get_cache_policy(header);
+                policy.store = policy.store && CACHE_BUDGET != 0 &&
+                               header.get_content_length() <= CACHE_BUDGET;
+                if (policy.store) {
+                    received.header = cached_header(header);
+                    received.etag = header.get_header("ETag");
+                    received.last_modified = header.get_header("Last-Modified");
+                    received.body.reserve(header.get_content_length());
+                }
+                if (on_header) {
+                    on_header(header);
+                }
+            },
+            [&](const char* data, size_t size) {
+                if (policy.store) {
+                    received.body.append(data, size);
+                }
+                on_body(data, size);
+            });
+        disconnect_from_server();
+        keep_cookies(r, url);
 
-            CERR(bytes < 0);
+        if (r.get_response_code() == 304 && entry) {
+            // Not modified, so neither the body nor its parsing are needed
+            cache.renew(key, get_cache_policy(r).max_age);
+            return replay();
+        }
 
-            if (bytes == 0) {
-                break;
-            }
+        if (is_code_success(r.get_response_code()) && policy.store) {
+            cache.store(key, std::move(received), policy.max_age);
+        } else if (entry) {
+            cache.invalidate(key);
+        }
+        return r;
+    }
 
-            ss << response;
+    /**
+     * @brief Execute a GET request through the response cache, and buffer
+     * the whole response
+     * @param url The url
+     * @return Response The response
+     */
+    Response cached_get(const std::string& url) {
+        std::string body;
+        Response r = cached_get(url, nullptr, [&](const char* data,
+                                                  size_t size) {
+            body.append(data, size);
+        });
+
+        if (!is_code_success(r.get_response_code())) {
+            return r;
         }
+        return Response(r.get_raw_header() + body);
+    }
 
-        // Return the full HTTP Response
-        return ss.str();
+    /**
+     * @brief Drop the cached responses of a resource that was modified, and
+     * of the collection that contains it
+     * @param url The url of the resource
+     */
+    void invalidate_cached(const std::string& url) {
+        std::string user = identity(*credentials.load());
+        cache.invalidate(ResponseCache::key("GET", url, user));
+        cache.invalidate(ResponseCache::key(
+            "GET", url.substr(0, url.find_last_of('/')), user));
     }
 
     /**
-     * @brief Connect to the REST server
+     * @brief Connect to the REST server. If it can't be reached, the command
+     * goes on without a connection, and receives an empty response (code 0)
      */
     void connect_to_server() {
-        in_addr ip = getIpFromHostname(host, port);
+        connection = pool.acquire(connection_reused);
+        if (!connection) {
+            *err_stream << "Couldn't connect to " << host << ":" << port
+                        << "\n";
+        }
+    }
 
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        MUST(sockfd >= 0, "Couldn't create socket\n");
+    /**
+     * @brief Disconnect from the REST server (the connection is kept open
+     * for the next command, if the server allows it)
+     */
+    void disconnect_from_server() {
+        if (connection) {
+            pool.release(std::move(connection));
+        }
+    }
 
-        bzero(&serv_addr, sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(port);
-        serv_addr.sin_addr = ip;
-        MUST(::connect(sockfd, (sockaddr*)&serv_addr, sizeof(serv_addr)) >= 0,
-             "Couldn't connect");
+    void send_to_server(const std::string& message) {
+        sent_request = message;
+        request_sent = connection && connection->send(message);
     }
 
     /**
-     * @brief Disconnect from the REST server
-     *
+     * @brief An idle connection may be closed by the server just as the
+     * request is sent on it. Then nothing is received, and the request is
+     * sent again, on a new connection, if it didn't reach the server or if
+     * it can be repeated safely (a POST that was received may have been
+     * applied)
+     * @return true The request was sent again
+     * @return false The connection was new, so the server didn't answer, the
+     * request can't be repeated, or a new connection couldn't be opened
      */
-    void disconnect_from_server() const { close(sockfd); }
+    bool resend_on_new_connection() {
+        if (!connection_reused ||
+            (request_sent && !can_resend(sent_request))) {
+            return false;
+        }
+
+        connection = std::make_unique<Connection>();
+        connection_reused = false;
+        if (!connection->try_open(endpoint)) {
+            connection.reset();
+            return false;
+        }
+        request_sent = connection->send(sent_request);
+        return true;
+    }
+
+    std::string receive_from_server() {
+        if (!connection) {
+            return "";
+        }
+        std::string_view method = request_method(sent_request);
+        std::string response = connection->receive(method);
+        if (response.size() == 0 && resend_on_new_connection()) {
+            response = connection->receive(method);
+        }
+        return response;
+    }
+
+    Response receive_streamed(
+        const std::function<void(const Response&)>& on_header,
+        const BodyHandler& on_body) {
+        if (!connection) {
+            return Response("");
+        }
+        Response r = connection->receive_streamed(on_header, on_body);
+        if (r.get_raw_header().size() == 0 && resend_on_new_connection()) {
+            r = connection->receive_streamed(on_header, on_body);
+        }
+        return r;
+    }
 
     /**
      * @brief Read a number from STDIN and validate it. It should be a positive
@@ -160,14 +396,14 @@ class Client {
     uint read_number(std::string prompt) {
         std::string idS;
         do {
-            std::cout << prompt;
+            *out_stream << prompt;
             std::cin >> idS;
 
-            if (!is_uint(idS)) {
-                std::cerr << "Invalid value!\n";
+            uint id;
+            if (!parse_uint_field(idS, id)) {
+                *err_stream << "Invalid value!\n";
             } else {
-                int id = std::stoi(idS);
-                return (uint)id;
+                return id;
             }
         }
         FOREVER;
@@ -179,7 +415,500 @@ class Client {
      * @param code The status code
      */
     void show_error(const std::string& msg, const uint code) {
-        std::cerr << msg << " - Error code " << code << "\n";
+        if (msg == "") {
+            *err_stream << (code == 0 ? "No response received!"
+                                      : "Request failed!");
+        }
+        *err_stream << msg << " - Error code " << code << "\n";
+    }
+
+    /**
+     * @brief Print a row of a listing
+     * @param books The listing
+     * @param row The row
+     */
+    void show_listing_row(const BookTable& books, const size_t row) {
+        *out_stream << "Book ID: " << books.id(row)
+                    << ", Title: " << json_quoted(books.title(row)) << "\n";
+    }
+
+    /**
+     * @brief Print the rows of a listing that a query selects, in its order
+     * @param books The listing
+     * @param query The query
+     */
+    void show_listing(const BookTable& books, const ListingQuery& query) {
+        std::vector<size_t> rows = books.rows(query);
+        if (books.size() == 0) {
+            *out_stream << "There are no books in your library!\n";
+            return;
+        }
+        if (rows.size() == 0) {
+            *out_stream << "No book matches the query!\n";
+            return;
+        }
+
+        *out_stream << "Received the books!\n";
+        for (auto row : rows) {
+            show_listing_row(books, row);
+        }
+    }
+
+    /**
+     * @brief Print all the information about a book
+     * @param book The book
+     */
+    void show_book(const Book& book) {
+        *out_stream << "Received the book!\n";
+        *out_stream << "Title: " << json_quoted(book.title) << "\n";
+        *out_stream << "Author: " << json_quoted(book.author) << "\n";
+        *out_stream << "Publisher: " << json_quoted(book.publisher) << "\n";
+        *out_stream << "Genre: " << json_quoted(book.genre) << "\n";
+        *out_stream << "Page NO.: " << book.page_count << "\n";
+    }
+
+    /**
+     * @brief The file with the snapshot of the library
+     */
+    std::string snapshot_path() const {
+        return std::string(SNAPSHOT_FILE) + "." + host + "." +
+               std::to_string(port);
+    }
+
+    /**
+     * @brief Save the local copy of the library, for the next run
+     */
+    void save_snapshot() {
+        if (std::string(SNAPSHOT_FILE) != "") {
+            library.save_snapshot(snapshot_path(),
+                                  credentials.load()->username);
+        }
+    }
+
+    /**
+     * @brief The file with the credentials
+     */
+    std::string credentials_path() const {
+        return std::string(CREDENTIALS_FILE) + "." + host + "." +
+               std::to_string(port);
+    }
+
+    /**
+     * @brief Save the credentials, for the next run
+     */
+    void save_credentials_file() {
+        SharedCredentials::Snapshot current = credentials.load();
+        if (std::string(CREDENTIALS_FILE) != "" &&
+            current != saved_credentials) {
+            save_credentials(credentials_path(), *current);
+            saved_credentials = current;
+        }
+    }
+
+    /**
+     * @brief Use new credentials (after a login, or a new token)
+     */
+    void store_credentials(const Credentials& next) {
+        credentials.store(next);
+        refresher.update();
+        save_credentials_file();
+    }
+
+    /**
+     * @brief A way to request a new token of the library, on a connection
+     * of its own (so it can be used in the background)
+     */
+    static TokenRefresher::Fetch token_fetch(Endpoint& endpoint) {
+        return [&endpoint](Credentials& credentials) {
+            const std::string& host = endpoint.get_host();
+            const std::string url = "/api/v1/tema/library/access";
+            std::string request = create_get_request(
+                host, url, "",
+                credentials.cookies.header(host, url, false, unix_now()));
+
+            // A server that can't be reached is a failed refresh, tried
+            // again later
+            Connection connection;
+            if (!connection.try_open(endpoint)) {
+                return false;
+            }
+            connection.send(request);
+            Response r(connection.receive());
+            r.store_cookies(credentials.cookies, host, url);
+
+            std::string token = r.get_string("token");
+            if (!is_code_success(r.get_response_code()) || token == "") {
+                return false;
+            }
+            credentials.token = token;
+            credentials.token_expires = jwt_expiry(token);
+            return true;
+        };
+    }
+
+    /**
+     * @brief Save the token that was refreshed in the background, if there
+     * is one. If the current token has expired, this waits for the refresh
+     */
+    void adopt_refreshed() {
+        refresher.get_valid();
+        save_credentials_file();
+    }
+
+    /**
+     * @brief Use the credentials saved by a previous run, if they are still
+     * valid, so the login and the access to the library can be skipped
+     */
+    void restore_credentials() {
+        Credentials credentials;
+        if (std::string(CREDENTIALS_FILE) == "" ||
+            !load_credentials(credentials_path(), credentials)) {
+            return;
+        }
+
+        credentials.drop_expired(unix_now());
+        if (credentials.session_id() == "") {
+            return;
+        }
+
+        this->credentials.store(credentials);
+        saved_credentials = this->credentials.load();
+        restored = true;
+        refresher.update();
+    }
+
+    /**
+     * @brief Forget the credentials, in memory and on disk
+     */
+    void clear_credentials() {
+        credentials.store(Credentials());
+        saved_credentials = credentials.load();
+        restored = false;
+        refresher.update();
+        if (std::string(CREDENTIALS_FILE) != "") {
+            unlink(credentials_path().c_str());
+        }
+    }
+
+    /**
+     * @brief Handle a request that was refused with saved credentials. The
+     * token is requested again with the saved session; if the session was
+     * refused too, the credentials are dropped and the user has to login
+     * @param code The response code of the refused request
+     * @return true New credentials were received, so the request can be
+     * repeated
+     * @return false The request can't be repeated
+     */
+    bool recover_access(const uint code) {
+        if (!restored || (code != 401 && code != 403)) {
+            return false;
+        }
+        restored = false;
+
+        Response r = request_access();
+        if (is_code_success(r.get_response_code())) {
+            return true;
+        }
+
+        clear_credentials();
+        library.clear();
+        *err_stream << "The saved session has expired, login again!\n";
+        return false;
+    }
+
+    /**
+     * @brief Request the listing in the background, on its own connection.
+     * The result is adopted by the next command (a server that can't be
+     * reached leaves the snapshot in use)
+     */
+    void reconcile() {
+        if (reconciling.valid()) {
+            return;
+        }
+
+        SharedCredentials::Snapshot auth = credentials.load();
+        std::string url = "/api/v1/tema/library/books";
+        std::string request = create_get_request(
+            host, url, "", cookie_line(*auth, url), auth->token);
+
+        reconcile_epoch = library.get_epoch();
+        auto fetch = [&endpoint = endpoint,
+                      request]() -> std::unique_ptr<BookTable> {
+            Connection connection;
+            if (!connection.try_open(endpoint)) {
+                return nullptr;
+            }
+            connection.send(request);
+            Response r(connection.receive());
+
+            std::vector<Book> books;
+            if (!is_code_success(r.get_response_code()) ||
+                !parse_book_list(r.body_view(), books)) {
+                return nullptr;
+            }
+
+            auto listing = std::make_unique<BookTable>();
+            for (auto& book : books) {
+                listing->append(book);
+            }
+            return listing;
+        };
+        reconciling = std::async(std::launch::async, fetch);
+    }
+
+    /**
+     * @brief Use the listing requested in the background, if it arrived
+     */
+    void adopt_reconciled() {
+        if (!reconciling.valid() ||
+            reconciling.wait_for(std::chrono::seconds(0)) !=
+                std::future_status::ready) {
+            return;
+        }
+
+        std::unique_ptr<BookTable> listing = reconciling.get();
+        if (listing) {
+            library.store_listing(std::move(*listing), reconcile_epoch);
+            save_snapshot();
+        }
+    }
+
+    /**
+     * @brief Why a request failed: the error returned by the server, or a
+     * generic message if the body doesn't have one (an empty body, or an
+     * HTML error page)
+     * @param r The response
+     */
+    static std::string response_error(Response& r) {
+        std::string error = r.get_string("error");
+        if (error == "") {
+            error = "Request failed!";
+        }
+        return error;
+    }
+
+    /**
+     * @brief Fetch a book on a pooled connection (called by the bulk
+     * commands, on the I/O threads)
+     * @param id The id of the book
+     * @param request The request
+     * @return BookResult The book, or why it couldn't be fetched
+     */
+    BookResult fetch_book(const uint id, const std::string& request) {
+        return book_flights.run(request,
+                                [&]() { return execute_book(id, request); });
+    }
+
+    /**
+     * @brief Send the request of a book, and parse its response
+     */
+    BookResult execute_book(const uint id, const std::string& request) {
+        Response r = pool.execute(request);
+
+        BookResult result;
+        result.id = id;
+        result.code = r.get_response_code();
+        if (r.get_headers("Set-Cookie").size() != 0) {
+            result.cookie_header = r.get_raw_header();
+        }
+
+        std::vector<Book> books;
+        if (result.code == 0) {
+            result.error = "No response received!";
+        } else if (!is_code_success(result.code)) {
+            result.error = response_error(r);
+        } else if (!parse_books(r.body_view(), books) || books.size() != 1) {
+            result.error = "Invalid book received!";
+        } else {
+            // The id isn't part of the body
+            result.book = books[0];
+            result.book.id = id;
+        }
+        return result;
+    }
+
+    /**
+     * @brief Add a book on a pooled connection (called by the import, on the
+     * I/O threads)
+     * @param book The book
+     * @param request The request
+     * @return BookResult The book, with its id if the server returned it
+     */
+    BookResult add_pooled(const Book& book, const std::string& request) {
+        Response r = pool.execute(request);
+
+        BookResult result;
+        result.code = r.get_response_code();
+        result.book = book;
+        if (r.get_headers("Set-Cookie").size() != 0) {
+            result.cookie_header = r.get_raw_header();
+        }
+
+        if (result.code == 0) {
+            result.error = "No response received!";
+        } else if (!is_code_success(result.code)) {
+            result.error = response_error(r);
+        } else {
+            // The id of the new book is only known if the server returns it
+            Book added;
+            if (r.body_view().size() != 0 && parse_book(r.body_view(), added)) {
+                result.book.id = added.id;
+            }
+        }
+        result.id = result.book.id;
+        return result;
+    }
+
+    /**
+     * @brief Start fetching books on the I/O threads (the ones known locally
+     * are ready right away)
+     * @param ids The ids of the books
+     * @return std::vector<std::future<BookResult>> The books, in the order of
+     * the ids
+     */
+    std::vector<std::future<BookResult>> request_books(
+        const std::vector<uint>& ids) {
+        ThreadPool& threads = io_threads(BULK_CONCURRENCY);
+
+        SharedCredentials::Snapshot auth = credentials.load();
+        const Snapshot* saved = library.get_snapshot(auth->username);
+
+        std::vector<std::future<BookResult>> pending;
+        pending.reserve(ids.size());
+        for (auto id : ids) {
+            BookResult local;
+            local.id = id;
+            local.code = 200;
+            if (const Book* known = library.get_book(id)) {
+                local.book = *known;
+            } else if (!saved || !saved->find(id, local.book)) {
+                std::string url = "/api/v1/tema/library/books/";
+                url.append(std::to_string(id));
+                std::string request = create_get_request(
+                    host, url, "", cookie_line(*auth, url), auth->token);
+
+                pending.push_back(threads.submit([this, id, request]() {
+                    return fetch_book(id, request);
+                }));
+                continue;
+            }
+
+            std::promise<BookResult> known;
+            known.set_value(local);
+            pending.push_back(known.get_future());
+        }
+        return pending;
+    }
+
+    /**
+     * @brief Wait for the books started by request_books, and keep them
+     * @param pending The books
+     * @param epoch The epoch of the library when they were requested
+     * @param on_result Called for every book, in order
+     * @return size_t How many books were fetched
+     */
+    size_t receive_books(
+        std::vector<std::future<BookResult>>& pending, const lint epoch,
+        const std::function<void(const BookResult&)>& on_result) {
+        size_t fetched = 0;
+        for (size_t i = 0; i < pending.size(); i++) {
+            BookResult result = pending[i].get();
+            if (result.ok()) {
+                library.store_book(result.book, epoch);
+                fetched++;
+            }
+            if (result.cookie_header != "") {
+                std::string url = "/api/v1/tema/library/books/";
+                keep_cookies(Response(result.cookie_header),
+                             url + std::to_string(result.id));
+            }
+            on_result(result);
+        }
+        return fetched;
+    }
+
+    /**
+     * @brief Request the listing of the library on a pooled connection (it
+     * can be called on any thread). The cookies it sets are kept by the
+     * caller, with keep_listing_cookies
+     * @return std::shared_ptr<const ListingResult> The listing
+     */
+    std::shared_ptr<const ListingResult> fetch_listing() {
+        SharedCredentials::Snapshot auth = refresher.get_valid();
+        std::string url = "/api/v1/tema/library/books";
+        std::string request = create_get_request(
+            host, url, "", cookie_line(*auth, url), auth->token);
+
+        return listing_flights.run(request, [&]() {
+            Response r = pool.execute(request);
+
+            auto result = std::make_shared<ListingResult>();
+            result->code = r.get_response_code();
+            if (r.get_headers("Set-Cookie").size() != 0) {
+                result->cookie_header = r.get_raw_header();
+            }
+
+            if (result->code == 0) {
+                result->error = "No response received!";
+            } else if (!is_code_success(result->code)) {
+                result->error = response_error(r);
+            } else if (!parse_book_list(r.body_view(), result->books)) {
+                result->error = "Incomplete list of books received!";
+            }
+            return std::shared_ptr<const ListingResult>(result);
+        });
+    }
+
+    /**
+     * @brief Keep the cookies set by the response of a listing
+     */
+    void keep_listing_cookies(const ListingResult& listing) {
+        if (listing.cookie_header != "") {
+            keep_cookies(Response(listing.cookie_header),
+                         "/api/v1/tema/library/books");
+        }
+    }
+
+    /**
+     * @brief Request the listing of the library on a pooled connection (the
+     * books only have their ids and titles)
+     * @param books Where the books are stored
+     * @return true The listing was received
+     * @return false It wasn't
+     */
+    bool list_books(std::vector<Book>& books) {
+        std::shared_ptr<const ListingResult> listing = fetch_listing();
+        keep_listing_cookies(*listing);
+        if (!listing->ok()) {
+            return false;
+        }
+        books = listing->books;
+        return true;
+    }
+
+    /**
+     * @brief The in-flight window of a bulk command
+     * @param window The window that was asked for (0 for BULK_CONCURRENCY)
+     * @return size_t The window, at most MAX_BULK_CONCURRENCY
+     */
+    static size_t bulk_window(const size_t window) {
+        return std::min<size_t>(window != 0 ? window : BULK_CONCURRENCY,
+                                MAX_BULK_CONCURRENCY);
+    }
+
+    /**
+     * @brief The threads of the bulk commands, at least as many as requested
+     * (and as many pooled connections), up to MAX_BULK_CONCURRENCY
+     * @param threads How many requests can be in flight
+     */
+    ThreadPool& io_threads(size_t threads) {
+        threads = std::min<size_t>(threads, MAX_BULK_CONCURRENCY);
+        if (!io_pool || io_pool->size() < threads) {
+            io_pool = std::make_unique<ThreadPool>(
+                std::max<size_t>(threads, BULK_CONCURRENCY));
+            pool.reserve(io_pool->size());
+        }
+        return *io_pool;
     }
 
 #pragma region Requests
@@ -197,164 +926,691 @@ class Client {
         std::string request = create_post_request(
             host, "/api/v1/tema/auth/register", "application/json", body_data);
 
-        send_to_server(request);
-        std::string response = receive_from_server();
-        disconnect_from_server();
+        send_to_server(request);
+        std::string response = receive_from_server();
+        disconnect_from_server();
+
+        Response r(response);
+
+        if (is_code_success(r.get_response_code())) {
+            *out_stream << "Registration succeded!\n";
+        } else {
+            show_error(r.get_string("error"), r.get_response_code());
+        }
+    }
+
+    /**
+     * @brief Login into an account. If the operation is successfull, the
+     * session id cookie will be set
+     * @param user The username
+     * @param pass The password
+     */
+    void login(const std::string& user, const std::string& pass) {
+        connect_to_server();
+        std::vector<KeyValue> body_data;
+        body_data.push_back(KeyValue("username", user));
+        body_data.push_back(KeyValue("password", pass));
+
+        std::string request = create_post_request(
+            host, "/api/v1/tema/auth/login", "application/json", body_data);
+
+        send_to_server(request);
+        std::string response = receive_from_server();
+        disconnect_from_server();
+
+        Response r(response);
+        Credentials next;
+        r.store_cookies(next.cookies, host, "/api/v1/tema/auth/login");
+        restored = false;
+
+        if (is_code_success(r.get_response_code())) {
+            next.username = user;
+            store_credentials(next);
+            *out_stream << "Login succeded!\n";
+        } else {
+            store_credentials(next);
+            show_error(r.get_string("error"), r.get_response_code());
+        }
+    }
+
+    /**
+     * @brief Request the JWT of the library, with the session id cookie. If
+     * the operation is successfull, the library_token will be set
+     * @return Response The response
+     */
+    Response request_access() {
+        SharedCredentials::Snapshot auth = credentials.load();
+        connect_to_server();
+        std::string url = "/api/v1/tema/library/access";
+        std::string request =
+            create_get_request(host, url, "", cookie_line(*auth, url));
+
+        send_to_server(request);
+        std::string response = receive_from_server();
+        disconnect_from_server();
+
+        Response r(response);
+        Credentials next = *auth;
+        r.store_cookies(next.cookies, host, url);
+        next.token = r.get_string("token");
+        next.token_expires = jwt_expiry(next.token);
+        if (is_code_success(r.get_response_code())) {
+            // A new token may give access to another library
+            library.clear();
+        }
+        store_credentials(next);
+        return r;
+    }
+
+    /**
+     * @brief Try to access the library. If the operation is successfull, the JWT library_token will be set
+     */
+    void enter_library() {
+        // Check if this application has received a session id (user has logged
+        // in succesfully)
+        SharedCredentials::Snapshot auth = credentials.load();
+        if (auth->session_id() == "") {
+            *err_stream << "Login into the account first!\n";
+            return;
+        }
+
+        Response r = request_access();
+        if (is_code_success(r.get_response_code())) {
+            *out_stream << "Authorized!\n";
+        } else {
+            // A saved session that is refused is of no use anymore
+            if (restored && (r.get_response_code() == 401 ||
+                             r.get_response_code() == 403)) {
+                clear_credentials();
+            }
+            show_error(r.get_string("error"), r.get_response_code());
+        }
+    }
+
+    /**
+     * @brief Will return a list with all the books in the library (their id and title)
+     * @param query Which books are shown, and in what order
+     */
+    void get_books(const ListingQuery& query = ListingQuery()) {
+        // Check if this application has received a session id (user has logged
+        // in succesfully)
+        SharedCredentials::Snapshot auth = credentials.load();
+        if (auth->session_id() == "") {
+            *err_stream << "Login into the account first!\n";
+            return;
+        }
+
+        if (auth->token == "") {
+            *err_stream << "Enter the library first\n";
+            return;
+        }
+
+        // A listing that is already on its way is faster than a new one
+        if (reconciling.valid()) {
+            reconciling.wait();
+            adopt_reconciled();
+        }
+
+        // The local copy of the library is used while it is fresh
+        if (const BookTable* known = library.get_listing()) {
+            show_listing(*known, query);
+            return;
+        }
+
+        // At startup, the snapshot is shown right away, while the server
+        // is asked for the current listing in the background
+        if (const Snapshot* saved = library.get_snapshot(auth->username)) {
+            BookTable known;
+            for (size_t row = 0; row < saved->size(); row++) {
+                Book book;
+                book.id = saved->id(row);
+                book.title = saved->title(row);
+                known.append(book);
+            }
+            show_listing(known, query);
+            reconcile();
+            return;
+        }
+
+        // The listing is kept in a columnar table, and shown from it
+        bool invalid = false;
+        lint epoch = library.get_epoch();
+        BookTable listing;
+
+        // A listing that is filtered or sorted is only shown once it is whole
+        bool streamed = query.is_default();
+        JsonArrayStream books([&](std::string_view elem) {
+            Book book;
+            if (!parse_book(elem, book)) {
+                invalid = true;
+                return;
+            }
+            listing.append(book);
+            if (streamed) {
+                if (listing.size() == 1) {
+                    *out_stream << "Received the books!\n";
+                }
+                show_listing_row(listing, listing.size() - 1);
+            }
+        });
+
+        // Every book is shown as soon as it is received, unless the listing
+        // is big enough to be parsed faster on all the cores
+        bool buffered = false;
+        std::string body;
+        Response r = cached_get(
+            "/api/v1/tema/library/books",
+            [&](const Response& header) {
+                buffered = PARALLEL_PARSE_THRESHOLD != 0 &&
+                           header.get_content_length() >=
+                               PARALLEL_PARSE_THRESHOLD;
+                if (buffered) {
+                    body.reserve(header.get_content_length());
+                }
+            },
+            [&](const char* data, size_t size) {
+                if (buffered) {
+                    body.append(data, size);
+                } else {
+                    books.feed(data, size);
+                }
+            });
 
-        Response r(response);
+        if (buffered) {
+            std::vector<Book> list;
+            invalid = !parse_book_list(body, list);
+            for (auto& book : list) {
+                listing.append(book);
+            }
+        } else if (!books.is_complete()) {
+            invalid = true;
+        }
 
         if (is_code_success(r.get_response_code())) {
-            std::cout << "Registration succeded!\n";
+            if (invalid) {
+                *err_stream << "Incomplete list of books received!\n";
+                return;
+            }
+
+            if (!streamed || buffered) {
+                show_listing(listing, query);
+            } else if (listing.size() == 0) {
+                *out_stream << "There are no books in your library!\n";
+            }
+            library.store_listing(std::move(listing), epoch);
+            save_snapshot();
+        } else if (recover_access(r.get_response_code())) {
+            get_books(query);
         } else {
-            show_error(r.get_json_data()["error"], r.get_response_code());
+            show_error(r.get_string("error"), r.get_response_code());
         }
     }
 
     /**
-     * @brief Login into an account. If the operation is successfull, the
-     * session id cookie will be set
-     * @param user The username
-     * @param pass The password
+     * @brief Will return information about a book from the library, with a specific id     * 
+     * @param id The book id 
      */
-    void login(const std::string& user, const std::string& pass) {
-        connect_to_server();
-        std::vector<KeyValue> body_data;
-        body_data.push_back(KeyValue("username", user));
-        body_data.push_back(KeyValue("password", pass));
+    void get_book(const uint id) {
+        // Check if this application has received a session id (user has logged
+        // in succesfully)
+        SharedCredentials::Snapshot auth = credentials.load();
+        if (auth->session_id() == "") {
+            *err_stream << "Login into the account first!\n";
+            return;
+        }
 
-        std::string request = create_post_request(
-            host, "/api/v1/tema/auth/login", "application/json", body_data);
+        if (auth->token == "") {
+            *err_stream << "Enter the library first\n";
+            return;
+        }
 
-        send_to_server(request);
-        std::string response = receive_from_server();
-        disconnect_from_server();
+        // The local copy of the library is used while it is fresh
+        if (const Book* known = library.get_book(id)) {
+            show_book(*known);
+            return;
+        }
 
-        Response r(response);
-        session_id = r.get_session_id();
+        Book saved_book;
+        const Snapshot* saved = library.get_snapshot(auth->username);
+        if (saved && saved->find(id, saved_book)) {
+            show_book(saved_book);
+            return;
+        }
+
+        std::string url = "/api/v1/tema/library/books/";
+        url.append(std::to_string(id));
 
+        lint epoch = library.get_epoch();
+        Response r = cached_get(url);
         if (is_code_success(r.get_response_code())) {
-            std::cout << "Login succeded!\n";
+            std::vector<Book> books;
+            if (!parse_books(r.body_view(), books)) {
+                *err_stream << "Invalid book received!\n";
+                return;
+            }
+
+            for (auto& book : books) {
+                // The id isn't part of the body
+                book.id = id;
+                show_book(book);
+            }
+            if (books.size() == 1) {
+                library.store_book(books[0], epoch);
+            }
+        } else if (recover_access(r.get_response_code())) {
+            get_book(id);
         } else {
-            show_error(r.get_json_data()["error"], r.get_response_code());
+            show_error(r.get_string("error"), r.get_response_code());
         }
     }
 
     /**
-     * @brief Try to access the library. If the operation is successfull, the JWT library_token will be set
+     * @brief Will return information about many books from the library
+     * @param ids The ids of the books
      */
-    void enter_library() {
+    void get_book_batch(const std::vector<uint>& ids) {
         // Check if this application has received a session id (user has logged
         // in succesfully)
-        if (session_id.is_null()) {
-            std::cerr << "Login into the account first!\n";
+        SharedCredentials::Snapshot auth = credentials.load();
+        if (auth->session_id() == "") {
+            *err_stream << "Login into the account first!\n";
             return;
         }
 
-        connect_to_server();
-        std::vector<Cookie> cookies;
-        cookies.push_back(session_id);
-
-        std::string request = create_get_request(
-            host, "/api/v1/tema/library/access", "", cookies);
-
-        send_to_server(request);
-        std::string response = receive_from_server();
-        disconnect_from_server();
-
-        Response r(response);
-        library_token = r.get_json_data()["token"];
-        if (is_code_success(r.get_response_code())) {
-            std::cout << "Authorized!\n";
-        } else {
-            show_error(r.get_json_data()["error"], r.get_response_code());
+        if (auth->token == "") {
+            *err_stream << "Enter the library first\n";
+            return;
         }
+
+        size_t fetched = fetch_books(ids, [&](const BookResult& result) {
+            *out_stream << "Book ID: " << result.id << "\n";
+            if (result.ok()) {
+                show_book(result.book);
+            } else {
+                show_error(result.error, result.code);
+            }
+        });
+        *out_stream << "Received " << fetched << " of " << ids.size()
+                    << " books!\n";
     }
 
     /**
-     * @brief Will return a list with all the books in the library (their id and title)
+     * @brief Add the books of a file to the library. The file is read as the
+     * requests are sent, with at most window requests in flight: when the
+     * window is full, the next book is only read after the oldest request is
+     * answered, so a large file never piles up in memory. The progress is
+     * journaled next to the file, so an interrupted import can be resumed
+     * @param path The file (CSV or JSON Lines)
+     * @param window How many requests can be in flight (0 for
+     * BULK_CONCURRENCY, at most MAX_BULK_CONCURRENCY)
      */
-    void get_books() {
+    void import_books(const std::string& path, size_t window) {
         // Check if this application has received a session id (user has logged
         // in succesfully)
-        if (session_id.is_null()) {
-            std::cerr << "Login into the account first!\n";
+        SharedCredentials::Snapshot auth = credentials.load();
+        if (auth->session_id() == "") {
+            *err_stream << "Login into the account first!\n";
             return;
         }
 
-        if (library_token == "") {
-            std::cerr << "Enter the library first\n";
+        if (auth->token == "") {
+            *err_stream << "Enter the library first\n";
             return;
         }
 
-        connect_to_server();
-        std::vector<Cookie> cookies;
-        cookies.push_back(session_id);
+        ImportReader reader;
+        std::string error;
+        if (!reader.open(path, error)) {
+            *err_stream << error << "\n";
+            return;
+        }
 
-        std::string request = create_get_request(
-            host, "/api/v1/tema/library/books", "", cookies, library_token);
+        // The journal only applies to the same file, imported by the same user
+        // on the same server
+        Journal journal;
+        bool journaled = std::string(JOURNAL_SUFFIX) != "";
+        if (journaled &&
+            journal.open(path + JOURNAL_SUFFIX,
+                         "import " + host + ":" + std::to_string(port) + " " +
+                             auth->username + " " + file_version(path))) {
+            *out_stream << "Resuming the import, " << journal.completed()
+                        << " books were already imported\n";
+        }
 
-        send_to_server(request);
-        std::string response = receive_from_server();
-        disconnect_from_server();
+        // The books that were sent when the previous run died may have been
+        // added; they are only sent again if their title isn't listed
+        std::unordered_map<std::string, size_t> titles;
+        bool listed = false;
 
-        Response r(response);
-        if (is_code_success(r.get_response_code())) {
-            if (r.get_json_data().size() != 0) {
-                std::cout << "Received the books!\n";
-                for (auto& elem : r.get_json_data()) {
-                    std::cout << "Book ID: " << elem["id"]
-                              << ", Title: " << elem["title"] << "\n";
-                }
+        window = bulk_window(window);
+        ThreadPool& threads = io_threads(window);
+
+        using Clock = std::chrono::steady_clock;
+        const Clock::time_point start = Clock::now();
+        Clock::time_point reported = start;
+        size_t imported = 0, failed = 0;
+
+        auto rate = [&]() {
+            double elapsed =
+                std::chrono::duration<double>(Clock::now() - start).count();
+            return elapsed > 0 ? imported / elapsed : 0;
+        };
+
+        // The requests in flight, with the lines of their books
+        std::string url = "/api/v1/tema/library/books";
+        std::deque<std::pair<lint, std::future<BookResult>>> in_flight;
+
+        auto finish_oldest = [&]() {
+            lint line = in_flight.front().first;
+            BookResult result = in_flight.front().second.get();
+            in_flight.pop_front();
+
+            if (result.cookie_header != "") {
+                keep_cookies(Response(result.cookie_header), url);
+            }
+            if (result.ok()) {
+                journal.finish(line);
+                library.added(result.book, result.book.id != 0);
+                imported++;
             } else {
-                std::cout << "There are no books in your library!\n";
+                *err_stream << "Line " << line << ": ";
+                show_error(result.error, result.code);
+                failed++;
             }
-        } else {
-            show_error(r.get_json_data()["error"], r.get_response_code());
+
+            if (show_progress &&
+                Clock::now() - reported >= std::chrono::seconds(1)) {
+                reported = Clock::now();
+                *err_stream << "Imported " << imported << " books, " << failed
+                            << " failed (" << (lint)rate() << " books/s)\n";
+            }
+        };
+
+        Book book;
+        bool valid;
+        lint line;
+        size_t skipped = 0, invalid = 0;
+        while (reader.next(book, valid, line)) {
+            if (journal.is_done(line)) {
+                skipped++;
+                continue;
+            }
+            if (!valid) {
+                *err_stream << "Line " << line << ": Invalid book!\n";
+                failed++;
+                invalid++;
+                continue;
+            }
+
+            if (journal.is_uncertain(line)) {
+                std::vector<Book> books;
+                if (!listed && (listed = list_books(books))) {
+                    for (auto& known : books) {
+                        titles[known.title]++;
+                    }
+                }
+                auto title = titles.find(book.title);
+                if (title != titles.end() && title->second != 0) {
+                    title->second--;
+                    journal.finish(line);
+                    skipped++;
+                    continue;
+                }
+            }
+
+            if (in_flight.size() >= window) {
+                finish_oldest();
+            }
+            journal.start(line);
+
+            // The token may be replaced during a long import
+            auth = refresher.get_valid();
+            std::string body;
+            write_book(body, book);
+            std::string request =
+                create_post_request(host, url, "application/json", body,
+                                    cookie_line(*auth, url), auth->token);
+
+            in_flight.emplace_back(
+                line, threads.submit([this, book, request]() {
+                    return add_pooled(book, request);
+                }));
+        }
+        while (in_flight.size() != 0) {
+            finish_oldest();
+        }
+
+        if (imported != 0) {
+            invalidate_cached(url);
+        }
+
+        // The journal is kept while there are books to retry (the invalid ones
+        // would only fail again)
+        if (journaled && failed == invalid) {
+            journal.remove();
+        }
+
+        double elapsed =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        *out_stream << "Imported " << imported << " of " << imported + failed
+                    << " books in " << elapsed << " s (" << (lint)rate()
+                    << " books/s)!\n";
+        if (skipped != 0) {
+            *out_stream << "Skipped " << skipped
+                        << " books imported by a previous run!\n";
         }
     }
 
     /**
-     * @brief Will return information about a book from the library, with a specific id     * 
-     * @param id The book id 
+     * @brief Save every book of the library in a file. The listing gives the
+     * ids, and the books are requested with at most window requests in
+     * flight; a writer thread puts them back in the order of their ids and
+     * writes the file in big blocks. The progress is journaled next to the
+     * file, so an interrupted export is resumed after its last written block
+     * (or before the first book that failed)
+     * @param path The file (CSV or JSON Lines)
+     * @param window How many requests can be in flight (0 for
+     * BULK_CONCURRENCY, at most MAX_BULK_CONCURRENCY)
      */
-    void get_book(const uint id) {
+    void export_books(const std::string& path, size_t window) {
         // Check if this application has received a session id (user has logged
         // in succesfully)
-        if (session_id.is_null()) {
-            std::cerr << "Login into the account first!\n";
+        SharedCredentials::Snapshot auth = credentials.load();
+        if (auth->session_id() == "") {
+            *err_stream << "Login into the account first!\n";
             return;
         }
 
-        if (library_token == "") {
-            std::cerr << "Enter the library first\n";
+        if (auth->token == "") {
+            *err_stream << "Enter the library first\n";
             return;
         }
 
-        connect_to_server();
-        std::vector<Cookie> cookies;
-        cookies.push_back(session_id);
+        std::vector<Book> listing;
+        if (!list_books(listing)) {
+            *err_stream << "Couldn't receive the list of books!\n";
+            return;
+        }
+        std::sort(listing.begin(), listing.end(),
+                  [](const Book& a, const Book& b) { return a.id < b.id; });
+
+        // The journal only applies to the same kind of file, exported by the
+        // same user from the same server
+        bool csv = has_extension(path, ".csv");
+        Journal journal;
+        std::string journal_path = path + JOURNAL_SUFFIX;
+        std::string job = "export " + host + ":" + std::to_string(port) + " " +
+                          auth->username + (csv ? " csv" : " jsonl");
+        bool journaled = std::string(JOURNAL_SUFFIX) != "";
+        bool resumed = journaled && journal.open(journal_path, job);
+
+        // The file is cut where the last checkpoint left it, as the blocks
+        // after it aren't known to be complete
+        int fd = -1;
+        struct stat info;
+        if (resumed && journal.last_key() != 0) {
+            fd = ::open(path.c_str(), O_WRONLY);
+            if (fd < 0 || fstat(fd, &info) != 0 ||
+                (lint)info.st_size < journal.last_offset() ||
+                ftruncate(fd, journal.last_offset()) != 0 ||
+                lseek(fd, 0, SEEK_END) < 0) {
+                resumed = false;
+            }
+        } else {
+            resumed = false;
+        }
 
-        std::string url = "/api/v1/tema/library/books/";
-        url.append(std::to_string(id));
-        std::string request =
-            create_get_request(host, url, "", cookies, library_token);
+        lint offset = 0;
+        if (resumed) {
+            offset = journal.last_offset();
+            *out_stream << "Resuming the export after the book "
+                        << journal.last_key() << "\n";
+        } else {
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (journaled) {
+                journal.remove();
+                journal.open(journal_path, job);
+            }
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                *err_stream << "Couldn't open " << path << "\n";
+                return;
+            }
 
-        send_to_server(request);
-        std::string response = receive_from_server();
-        disconnect_from_server();
+            std::string header;
+            if (csv) {
+                write_csv_header(header);
+            }
+            CERR(write(fd, header.data(), header.size()) !=
+                 (ssize_t)header.size());
+            offset = header.size();
+        }
 
-        Response r(response);
-        if (is_code_success(r.get_response_code())) {
-            std::cout << "Received the book!\n";
-            for (auto& elem : r.get_json_data()) {
-                std::cout << "Title: " << elem["title"] << "\n";
-                std::cout << "Author: " << elem["author"] << "\n";
-                std::cout << "Publisher: " << elem["publisher"] << "\n";
-                std::cout << "Genre: " << elem["genre"] << "\n";
-                std::cout << "Page NO.: " << elem["page_count"] << "\n";
+        std::vector<lint> ids;
+        for (auto& book : listing) {
+            if (book.id > journal.last_key() || !resumed) {
+                ids.push_back(book.id);
             }
-        } else {
-            show_error(r.get_json_data()["error"], r.get_response_code());
+        }
+
+        window = bulk_window(window);
+        ThreadPool& threads = io_threads(window);
+
+        // The blocks are journaled as soon as they are written, but never
+        // past a book that failed, so a rerun exports it again
+        std::atomic<lint> first_failed(ids.size());
+        OrderedWriter writer(fd, offset, [&](lint last, lint size) {
+            if (last < first_failed) {
+                journal.checkpoint(ids[last], size);
+            }
+        });
+
+        // The failures and the cookies of the responses, handled on this
+        // thread
+        std::mutex reports_mutex;
+        std::vector<BookResult> reports;
+        size_t failed = 0;
+        auto handle_reports = [&]() {
+            std::vector<BookResult> ready;
+            {
+                std::lock_guard<std::mutex> lock(reports_mutex);
+                ready.swap(reports);
+            }
+            for (auto& result : ready) {
+                if (result.cookie_header != "") {
+                    std::string url = "/api/v1/tema/library/books/";
+                    keep_cookies(Response(result.cookie_header),
+                                 url + std::to_string(result.id));
+                }
+                if (!result.ok()) {
+                    *err_stream << "Book ID: " << result.id << ": ";
+                    show_error(result.error, result.code);
+                    failed++;
+                }
+            }
+        };
+
+        using Clock = std::chrono::steady_clock;
+        const Clock::time_point start = Clock::now();
+        Clock::time_point reported = start;
+
+        for (size_t seq = 0; seq < ids.size(); seq++) {
+            writer.wait_written(seq >= window ? seq - window + 1 : 0);
+            handle_reports();
+
+            if (show_progress &&
+                Clock::now() - reported >= std::chrono::seconds(1)) {
+                reported = Clock::now();
+                double elapsed =
+                    std::chrono::duration<double>(reported - start).count();
+                lint written = writer.written();
+                *err_stream << "Exported " << written << " of " << ids.size()
+                            << " books (" << (lint)(written / elapsed)
+                            << " books/s)\n";
+            }
+
+            // The token may be replaced during a long export
+            auth = refresher.get_valid();
+            uint id = ids[seq];
+            std::string url = "/api/v1/tema/library/books/";
+            url.append(std::to_string(id));
+            std::string request = create_get_request(
+                host, url, "", cookie_line(*auth, url), auth->token);
+
+            threads.submit([this, &writer, &reports_mutex, &reports,
+                            &first_failed, seq, id, request, csv]() {
+                BookResult result = fetch_book(id, request);
+                std::string record;
+                if (result.ok() && csv) {
+                    write_csv_book(record, result.book);
+                } else if (result.ok()) {
+                    write_book(record, result.book, true);
+                    record.push_back('\n');
+                } else {
+                    lint first = first_failed;
+                    while (seq < first &&
+                           !first_failed.compare_exchange_weak(first, seq)) {
+                    }
+                }
+
+                // Reported before the record is written, so all the reports
+                // are in once the writer is done
+                if (!result.ok() || result.cookie_header != "") {
+                    result.book = Book();
+                    std::lock_guard<std::mutex> lock(reports_mutex);
+                    reports.push_back(std::move(result));
+                }
+                writer.push(seq, std::move(record));
+            });
+        }
+
+        writer.wait_written(ids.size());
+        bool written = writer.close();
+        close(fd);
+        handle_reports();
+
+        if (!written) {
+            *err_stream << "Couldn't write " << path << "\n";
+            return;
+        }
+
+        // The journal is kept while there are books to retry
+        if (journaled && failed == 0) {
+            journal.remove();
+        }
+
+        size_t exported = ids.size() - failed;
+        double elapsed =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        *out_stream << "Exported " << exported << " of " << ids.size()
+                    << " books in " << elapsed << " s ("
+                    << (lint)(elapsed > 0 ? exported / elapsed : 0)
+                    << " books/s)!\n";
+        if (failed != 0) {
+            *err_stream << failed << " books couldn't be exported, run the "
+                        << "export again to retry them!\n";
         }
     }
 
@@ -371,41 +1627,54 @@ class Client {
                   const uint page_count) {
         // Check if this application has received a session id (user has logged
         // in succesfully)
-        if (session_id.is_null()) {
-            std::cerr << "Login into the account first!\n";
+        SharedCredentials::Snapshot auth = credentials.load();
+        if (auth->session_id() == "") {
+            *err_stream << "Login into the account first!\n";
             return;
         }
 
-        if (library_token == "") {
-            std::cerr << "Enter the library first\n";
+        if (auth->token == "") {
+            *err_stream << "Enter the library first\n";
             return;
         }
 
         connect_to_server();
-        std::vector<Cookie> cookies;
-        cookies.push_back(session_id);
 
-        connect_to_server();
-        std::vector<KeyValue> body_data;
-        body_data.push_back(KeyValue("title", title));
-        body_data.push_back(KeyValue("author", author));
-        body_data.push_back(KeyValue("genre", genre));
-        body_data.push_back(KeyValue("page_count", std::to_string(page_count)));
-        body_data.push_back(KeyValue("publisher", publisher));
+        Book book;
+        book.title = title;
+        book.author = author;
+        book.genre = genre;
+        book.publisher = publisher;
+        book.page_count = page_count;
 
-        std::string request = create_post_request(
-            host, "/api/v1/tema/library/books", "application/json", body_data,
-            cookies, library_token);
+        std::string body;
+        write_book(body, book);
+
+        std::string url = "/api/v1/tema/library/books";
+        std::string request =
+            create_post_request(host, url, "application/json", body,
+                                cookie_line(*auth, url), auth->token);
 
         send_to_server(request);
         std::string response = receive_from_server();
         disconnect_from_server();
 
         Response r(response);
+        keep_cookies(r, url);
         if (is_code_success(r.get_response_code())) {
-            std::cout << "Added book to the library!\n";
+            // The id of the new book is only known if the server returns it
+            Book added;
+            bool has_id = r.body_view().size() != 0 &&
+                          parse_book(r.body_view(), added) && added.id != 0;
+            book.id = added.id;
+            library.added(book, has_id);
+
+            invalidate_cached(url);
+            *out_stream << "Added book to the library!\n";
+        } else if (recover_access(r.get_response_code())) {
+            add_book(title, author, genre, publisher, page_count);
         } else {
-            show_error(r.get_json_data()["error"], r.get_response_code());
+            show_error(r.get_string("error"), r.get_response_code());
         }
     }
 
@@ -416,34 +1685,38 @@ class Client {
     void delete_book(const uint id) {
         // Check if this application has received a session id (user has logged
         // in succesfully)
-        if (session_id.is_null()) {
-            std::cerr << "Login into the account first!\n";
+        SharedCredentials::Snapshot auth = credentials.load();
+        if (auth->session_id() == "") {
+            *err_stream << "Login into the account first!\n";
             return;
         }
 
-        if (library_token == "") {
-            std::cerr << "Enter the library first\n";
+        if (auth->token == "") {
+            *err_stream << "Enter the library first\n";
             return;
         }
 
         connect_to_server();
-        std::vector<Cookie> cookies;
-        cookies.push_back(session_id);
 
         std::string url = "/api/v1/tema/library/books/";
         url.append(std::to_string(id));
-        std::string request =
-            create_delete_request(host, url, cookies, library_token);
+        std::string request = create_delete_request(
+            host, url, cookie_line(*auth, url), auth->token);
 
         send_to_server(request);
         std::string response = receive_from_server();
         disconnect_from_server();
 
         Response r(response);
+        keep_cookies(r, url);
         if (is_code_success(r.get_response_code())) {
-            std::cout << "Removed the book from the library!\n";
+            library.removed(id);
+            invalidate_cached(url);
+            *out_stream << "Removed the book from the library!\n";
+        } else if (recover_access(r.get_response_code())) {
+            delete_book(id);
         } else {
-            show_error(r.get_json_data()["error"], r.get_response_code());
+            show_error(r.get_string("error"), r.get_response_code());
         }
     }
 
@@ -453,17 +1726,16 @@ class Client {
     void logout() {
         // Check if this application has received a session id (user has logged
         // in succesfully)
-        if (session_id.is_null()) {
-            std::cerr << "Login into the account first!\n";
+        SharedCredentials::Snapshot auth = credentials.load();
+        if (auth->session_id() == "") {
+            *err_stream << "Login into the account first!\n";
             return;
         }
 
         connect_to_server();
-        std::vector<Cookie> cookies;
-        cookies.push_back(session_id);
-
+        std::string url = "/api/v1/tema/auth/logout";
         std::string request =
-            create_get_request(host, "/api/v1/tema/auth/logout", "", cookies);
+            create_get_request(host, url, "", cookie_line(*auth, url));
 
         send_to_server(request);
         std::string response = receive_from_server();
@@ -471,14 +1743,231 @@ class Client {
 
         Response r(response);
         if (is_code_success(r.get_response_code())) {
-            std::cout << "You logged out!\n";
+            *out_stream << "You logged out!\n";
+            // The library is kept on disk for the next run
+            save_snapshot();
+            cache.clear();
+            library.clear();
+
+            // Delete the cookie, and the saved credentials
+            clear_credentials();
+        } else {
+            show_error(r.get_string("error"), r.get_response_code());
+        }
+    }
+
+#pragma endregion
+
+#pragma region Batch
+    /**
+     * @brief Leave, like the exit command: a saved session is kept for the
+     * next run, otherwise the user is logged out
+     */
+    void close_session() {
+        if (std::string(CREDENTIALS_FILE) == "") {
+            logout();
+        } else {
+            save_snapshot();
+        }
+    }
+
+    /**
+     * @brief Run commands with their messages captured, instead of printed.
+     * Only the streams of the client are redirected, so what the other
+     * threads print isn't mixed in
+     * @param action Runs the commands
+     * @param output What they printed as results
+     * @param errors What they printed as errors
+     */
+    void capture(const std::function<void()>& action, std::string& output,
+                 std::string& errors) {
+        std::stringstream out, err;
+        struct Restore {
+            Client& client;
+            ~Restore() {
+                client.out_stream = &std::cout;
+                client.err_stream = &std::cerr;
+            }
+        } restore{*this};
+        out_stream = &out;
+        err_stream = &err;
+        action();
+
+        output = out.str();
+        errors = err.str();
+        while (output.size() != 0 && output.back() == '\n') {
+            output.pop_back();
+        }
+        while (errors.size() != 0 && errors.back() == '\n') {
+            errors.pop_back();
+        }
+    }
+
+    /**
+     * @brief The first fields of the result of a batch command
+     */
+    static json batch_result(const BatchCommand& command) {
+        return json{{"line", command.line}, {"command", command.name}};
+    }
+
+    /**
+     * @brief Start a read of a batch. Its requests are sent on the I/O
+     * threads, so the reads after it don't wait for it
+     * @param command The command
+     * @return std::function<json()> Waits for the read (on this thread),
+     * keeps what it received, and returns its result
+     */
+    std::function<json()> start_read(const BatchCommand& command) {
+        json result = batch_result(command);
+
+        std::string list;
+        for (auto& arg : command.args) {
+            list.append(arg).push_back(' ');
+        }
+        std::vector<uint> ids;
+        ListingQuery query;
+        bool valid = command.name == "get_books"
+                         ? parse_listing_query(command.args, query)
+                         : parse_id_list(list, ids) && ids.size() != 0 &&
+                               (command.name != "get_book" || ids.size() == 1);
+
+        SharedCredentials::Snapshot auth = credentials.load();
+        std::string error;
+        if (!valid) {
+            error = "Invalid input!";
+        } else if (auth->session_id() == "") {
+            error = "Login into the account first!";
+        } else if (auth->token == "") {
+            error = "Enter the library first";
+        }
+        if (error != "") {
+            result["ok"] = false;
+            result["error"] = error;
+            return [result]() { return result; };
+        }
+
+        lint epoch = library.get_epoch();
+        if (command.name != "get_books") {
+            using Pending = std::vector<std::future<BookResult>>;
+            auto pending = std::make_shared<Pending>(request_books(ids));
+            bool single = command.name == "get_book";
+
+            return [this, result, pending, epoch, single]() mutable {
+                json books = json::array();
+                json failed = json::array();
+                receive_books(*pending, epoch, [&](const BookResult& book) {
+                    if (book.ok()) {
+                        books.push_back(book_to_json(book.book));
+                    } else {
+                        failed.push_back({{"id", book.id},
+                                          {"code", book.code},
+                                          {"error", book.error}});
+                    }
+                });
+
+                result["ok"] = failed.size() == 0;
+                if (!single) {
+                    result["books"] = books;
+                    result["failed"] = failed;
+                } else if (books.size() != 0) {
+                    result["book"] = books[0];
+                } else {
+                    result["code"] = failed[0]["code"];
+                    result["error"] = failed[0]["error"];
+                }
+                return result;
+            };
+        }
+
+        // The local copy of the library is used while it is fresh
+        if (const BookTable* known = library.get_listing()) {
+            json books = json::array();
+            for (auto row : known->rows(query)) {
+                books.push_back({{"id", known->id(row)},
+                                 {"title", std::string(known->title(row))}});
+            }
+            result["ok"] = true;
+            result["books"] = books;
+            return [result]() { return result; };
+        }
+
+        using Listing = std::shared_ptr<const ListingResult>;
+        auto listing = std::make_shared<std::future<Listing>>(
+            io_threads(BULK_CONCURRENCY).submit([this]() {
+                return fetch_listing();
+            }));
+        return [this, result, listing, epoch, query]() mutable {
+            Listing list = listing->get();
+            keep_listing_cookies(*list);
+
+            if (!list->ok()) {
+                result["ok"] = false;
+                if (!is_code_success(list->code)) {
+                    result["code"] = list->code;
+                }
+                result["error"] = list->error;
+                return result;
+            }
+
+            BookTable table;
+            for (auto& book : list->books) {
+                table.append(book);
+            }
+            json books = json::array();
+            for (auto row : table.rows(query)) {
+                books.push_back({{"id", table.id(row)},
+                                 {"title", std::string(table.title(row))}});
+            }
+            library.store_listing(std::move(table), epoch);
+            save_snapshot();
 
-            // Delete the cookie
-            session_id.set_key("");
-            session_id.set_value("");
+            result["ok"] = true;
+            result["books"] = books;
+            return result;
+        };
+    }
+
+    /**
+     * @brief Run a command of a batch that isn't a read, with the arguments
+     * given instead of the prompts
+     * @param command The command
+     * @param quit Set by the exit command
+     * @return true The command and its arguments are valid
+     * @return false They aren't
+     */
+    bool run_command(const BatchCommand& command, bool& quit) {
+        const std::string& name = command.name;
+        const std::vector<std::string>& args = command.args;
+        uint number = 0;
+
+        if (name == "register" && args.size() == 2) {
+            registration(args[0], args[1]);
+        } else if (name == "login" && args.size() == 2) {
+            login(args[0], args[1]);
+        } else if (name == "enter_library" && args.size() == 0) {
+            enter_library();
+        } else if (name == "add_book" && args.size() == 5 &&
+                   parse_uint_field(args[4], number)) {
+            add_book(args[0], args[1], args[2], args[3], number);
+        } else if (name == "delete_book" && args.size() == 1 &&
+                   parse_uint_field(args[0], number)) {
+            delete_book(number);
+        } else if ((name == "import_books" || name == "export") &&
+                   (args.size() == 1 ||
+                    (args.size() == 2 && parse_uint_field(args[1], number)))) {
+            if (name == "import_books") {
+                import_books(args[0], number);
+            } else {
+                export_books(args[0], number);
+            }
+        } else if (name == "logout" && args.size() == 0) {
+            logout();
+        } else if (name == "exit" && args.size() == 0) {
+            quit = true;
         } else {
-            show_error(r.get_json_data()["error"], r.get_response_code());
+            return false;
         }
+        return true;
     }
 
 #pragma endregion
@@ -489,15 +1978,172 @@ class Client {
      * @param host The host to connect to
      * @param port The port on which the connection will be established
      */
-    Client(const std::string& host, const int port) : port(port), host(host) {
-        connect_to_server();
-        disconnect_from_server();
+    Client(const std::string& host, const int port)
+        : port(port),
+          host(host),
+          endpoint(host, port),
+          connection_reused(false),
+          request_sent(false),
+          restored(false),
+          reconcile_epoch(0),
+          cache(CACHE_BUDGET),
+          refresher(credentials, token_fetch(endpoint), TOKEN_REFRESH_MARGIN),
+          show_progress(true),
+          resident(false),
+          pool(endpoint, BULK_CONCURRENCY),
+          out_stream(&std::cout),
+          err_stream(&std::cerr) {
+        // Nothing waits for the server at startup: the host is resolved and
+        // the first connection is opened while the first command is read
+        preconnecting =
+            std::async(std::launch::async, [this] { pool.preconnect(); });
+
+        // The credentials of the last run are used, if they are still valid
+        saved_credentials = credentials.load();
+        restore_credentials();
+
+        // The snapshot is mapped before anything is sent to the server
+        auto saved = std::make_unique<Snapshot>();
+        if (std::string(SNAPSHOT_FILE) != "" && saved->open(snapshot_path())) {
+            library.attach_snapshot(std::move(saved));
+        }
+    }
+
+    /**
+     * @brief Fetch many books, with at most BULK_CONCURRENCY requests in
+     * flight, over persistent connections. The books known locally aren't
+     * requested. A book that can't be fetched doesn't stop the others
+     * @param ids The ids of the books
+     * @param on_result Called for every book, in the order of the ids, as
+     * soon as it (and the ones before it) are fetched
+     * @return size_t How many books were fetched
+     */
+    size_t fetch_books(
+        const std::vector<uint>& ids,
+        const std::function<void(const BookResult&)>& on_result) {
+        lint epoch = library.get_epoch();
+        std::vector<std::future<BookResult>> pending = request_books(ids);
+        return receive_books(pending, epoch, on_result);
+    }
+
+    /**
+     * @brief Run the commands of a script, with their arguments instead of
+     * the prompts. The reads that follow each other run concurrently; any
+     * other command waits for the commands before it, and the ones after it
+     * wait for it (a login, for example, is done before the reads that need
+     * it). Every command prints a JSON line with its result, in the order of
+     * the script
+     * @param commands The commands
+     * @param out Where the results are printed
+     * @return true Every command succeeded
+     * @return false One failed
+     */
+    bool run_batch(const std::vector<BatchCommand>& commands,
+                   std::ostream& out = std::cout) {
+        show_progress = false;
+        bool ok = true;
+        bool quit = false;
+
+        std::deque<std::function<json()>> reads;
+        auto print = [&](const json& result) {
+            ok = ok && result["ok"].get<bool>();
+            out << result.dump(-1, ' ', false, json::error_handler_t::replace)
+                << "\n";
+        };
+        auto finish_reads = [&]() {
+            while (reads.size() != 0) {
+                print(reads.front()());
+                reads.pop_front();
+            }
+        };
+
+        for (auto& command : commands) {
+            adopt_refreshed();
+            adopt_reconciled();
+
+            if (is_read_command(command.name)) {
+                reads.push_back(start_read(command));
+                continue;
+            }
+            finish_reads();
+
+            bool valid = true;
+            std::string output, errors;
+            capture([&] { valid = run_command(command, quit); }, output,
+                    errors);
+
+            json result = batch_result(command);
+            result["ok"] = valid && errors == "";
+            if (output != "") {
+                result["output"] = output;
+            }
+            if (!valid) {
+                result["error"] = "Invalid input!";
+            } else if (errors != "") {
+                result["error"] = errors;
+            }
+            print(result);
+
+            if (quit) {
+                break;
+            }
+        }
+        finish_reads();
+        out.flush();
+
+        // The daemon keeps the session for the next scripts
+        if (!resident) {
+            std::string output, errors;
+            capture([&] { close_session(); }, output, errors);
+        }
+        return ok;
+    }
+
+    /**
+     * @brief Stay resident, and run the scripts sent on a UNIX socket, one
+     * after the other. The connections, the cache, the local copy of the
+     * library and the credentials stay warm between them. An exit command
+     * only ends its script; SIGINT or SIGTERM stops the daemon, which leaves
+     * like the exit command
+     * @param path The socket
+     */
+    void serve(const std::string& path) {
+        DaemonSocket daemon;
+        daemon.open(path);
+        resident = true;
+        *out_stream << "Listening on " << path << "\n";
+        std::cout.flush();
+
+        std::string script;
+        int fd;
+        while ((fd = daemon.accept(script)) >= 0) {
+            SocketBuffer buffer(fd);
+            std::ostream out(&buffer);
+
+            std::vector<BatchCommand> commands;
+            std::string error;
+            std::istringstream in(script);
+            if (read_script(in, commands, error)) {
+                run_batch(commands, out);
+            } else {
+                out << json{{"ok", false}, {"error", error}}.dump() << "\n";
+            }
+            out.flush();
+            close(fd);
+        }
+
+        daemon.close_socket();
+        resident = false;
+        std::string output, errors;
+        capture([&] { close_session(); }, output, errors);
     }
 
     void run() {
         do {
             std::string command;
             std::cin >> command;
+            adopt_refreshed();
+            adopt_reconciled();
 
             // Make the input lowercase
             std::transform(command.begin(), command.end(), command.begin(),
@@ -505,7 +2151,7 @@ class Client {
 
             if (command == "register") {
                 std::string user;
-                std::cout << "Username: ";
+                *out_stream << "Username: ";
                 std::cin >> user;
 
                 std::string pass, confirm;
@@ -514,26 +2160,26 @@ class Client {
                     confirm = std::string(getpass("Confirm password: "));
 
                     if (pass != confirm) {
-                        std::cerr << "Passwords are not the same!\n";
-                        std::cout << "\n";
+                        *err_stream << "Passwords are not the same!\n";
+                        *out_stream << "\n";
                         continue;
                     }
                 } else {
-                    std::cout << "Password: ";
+                    *out_stream << "Password: ";
                     std::cin >> pass;
                 }
 
                 registration(user, pass);
             } else if (command == "login") {
                 std::string user;
-                std::cout << "Username: ";
+                *out_stream << "Username: ";
                 std::cin >> user;
 
                 std::string pass;
                 if (HIDE_PASS) {
                     pass = std::string(getpass("Password: "));
                 } else {
-                    std::cout << "Password: ";
+                    *out_stream << "Password: ";
                     std::cin >> pass;
                 }
 
@@ -541,21 +2187,61 @@ class Client {
             } else if (command == "enter_library") {
                 enter_library();
             } else if (command == "get_books") {
-                get_books();
+                // The query is optional, on the same line
+                std::string line;
+                std::vector<std::string> args;
+                ListingQuery query;
+                std::getline(std::cin, line);
+                if (!split_command(line, args) ||
+                    !parse_listing_query(args, query)) {
+                    *err_stream << "Invalid value!\n";
+                } else {
+                    get_books(query);
+                }
             } else if (command == "get_book") {
                 uint id = read_number("Book id: ");
                 get_book(id);
+            } else if (command == "get_book_batch") {
+                std::string list;
+                std::vector<uint> ids;
+                std::cin.ignore();
+                do {
+                    ids.clear();
+                    *out_stream << "Book ids: ";
+                    std::getline(std::cin, list);
+                    if (parse_id_list(list, ids) && ids.size() != 0) {
+                        break;
+                    }
+                    *err_stream << "Invalid value!\n";
+                } while (std::cin);
+                get_book_batch(ids);
+            } else if (command == "import_books") {
+                std::string path;
+                std::cin.ignore();
+                *out_stream << "File: ";
+                std::getline(std::cin, path);
+                uint window = read_number("In-flight window: ");
+
+                import_books(path, window);
+            } else if (command == "export") {
+                std::string path;
+                std::cin.ignore();
+                *out_stream << "File: ";
+                std::getline(std::cin, path);
+                uint window = read_number("In-flight window: ");
+
+                export_books(path, window);
             } else if (command == "add_book") {
                 std::string title, author, genre, publisher;
                 uint page_count;
                 std::cin.ignore();
-                std::cout << "Title: ";
+                *out_stream << "Title: ";
                 std::getline(std::cin, title);
-                std::cout << "Author: ";
+                *out_stream << "Author: ";
                 std::getline(std::cin, author);
-                std::cout << "Genre: ";
+                *out_stream << "Genre: ";
                 std::getline(std::cin, genre);
-                std::cout << "Publisher: ";
+                *out_stream << "Publisher: ";
                 std::getline(std::cin, publisher);
                 page_count = read_number("Number of pages: ");
 
@@ -566,12 +2252,12 @@ class Client {
             } else if (command == "logout") {
                 logout();
             } else if (command == "exit") {
-                logout();
+                close_session();
                 return;
             } else {
-                std::cout << "Invalid input!\n";
+                *out_stream << "Invalid input!\n";
             }
-            std::cout << "\n";
+            *out_stream << "\n";
         }
         FOREVER;
     }
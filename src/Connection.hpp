@@ -0,0 +1,347 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Response.hpp"
+#include "Scanner.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief The address of the REST server. The host is resolved once, by the
+ * first connection that needs it, and the address is shared by all the
+ * connections, so only the first one pays for the DNS lookup. A failed
+ * lookup isn't kept: the next connection tries again
+ */
+class Endpoint {
+   private:
+    std::string host;
+    int port;
+
+    std::mutex resolving;
+    std::atomic<bool> resolved;
+    in_addr ip;
+
+   public:
+    Endpoint(const std::string& host, const int port)
+        : host(host), port(port), resolved(false) {}
+
+    Endpoint(const Endpoint&) = delete;
+    Endpoint& operator=(const Endpoint&) = delete;
+
+    const std::string& get_host() const { return host; }
+
+    int get_port() const { return port; }
+
+    /**
+     * @brief Get the address of the server (from any thread)
+     * @param address Where the address is stored
+     * @return true The host was found
+     * @return false It wasn't
+     */
+    bool resolve(sockaddr_in& address) {
+        if (!resolved) {
+            std::lock_guard<std::mutex> lock(resolving);
+            if (!resolved && resolve_host(host, port, ip)) {
+                resolved = true;
+            }
+        }
+        if (!resolved) {
+            return false;
+        }
+
+        bzero(&address, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr = ip;
+        return true;
+    }
+};
+
+/**
+ * @brief A TCP connection to the REST server, used to send requests and
+ * receive their responses
+ */
+class Connection {
+   private:
+    int sockfd;
+
+    // The last response was received whole, and the server didn't ask for
+    // the connection to be closed, so it can be used for another request
+    mutable bool reusable;
+
+   public:
+    Connection() : sockfd(-1), reusable(false) {}
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    /**
+     * @brief Connect to the REST server
+     * @param endpoint The address of the server
+     * @return true The connection was established
+     * @return false The host wasn't found, or it refused the connection
+     */
+    bool try_open(Endpoint& endpoint) {
+        close();
+        sockaddr_in serv_addr;
+        if (!endpoint.resolve(serv_addr)) {
+            return false;
+        }
+
+        sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        MUST(sockfd >= 0, "Couldn't create socket\n");
+        if (::connect(sockfd, (sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Connect to the REST server, or exit if it can't be reached
+     * @param endpoint The address of the server
+     */
+    void open(Endpoint& endpoint) {
+        MUST(try_open(endpoint), "Couldn't connect to "
+                                     << endpoint.get_host() << ":"
+                                     << endpoint.get_port() << "\n");
+    }
+
+    /**
+     * @brief Disconnect from the REST server
+     */
+    void close() {
+        if (sockfd >= 0) {
+            ::close(sockfd);
+            sockfd = -1;
+        }
+        reusable = false;
+    }
+
+    bool is_open() const { return sockfd >= 0; }
+
+    /**
+     * @brief Check if another request can be sent on this connection
+     */
+    bool can_reuse() const { return is_open() && reusable; }
+
+    /**
+     * @brief Check that an idle connection wasn't closed by the server
+     * meanwhile (nothing can be read from it, and it hasn't ended)
+     */
+    bool is_alive() const {
+        char byte;
+        ssize_t bytes = recv(sockfd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    /**
+     * @brief Send a HTTP request to the server
+     * @param message The request
+     * @return true The whole request was sent
+     * @return false The connection was closed before that (so the server
+     * didn't get the request)
+     */
+    bool send(const std::string& message) const {
+        int bytes, sent = 0;
+        int total = message.size();
+
+        do {
+            // A connection closed by the server is an error, not a signal
+            bytes = ::send(sockfd, message.c_str() + sent, total - sent,
+                           MSG_NOSIGNAL);
+            CERR(bytes < 0 && errno != EPIPE && errno != ECONNRESET);
+
+            if (bytes <= 0) {
+                reusable = false;
+                return false;
+            }
+
+            sent += bytes;
+        } while (sent < total);
+        return true;
+    }
+
+    /**
+     * @brief Receive a HTTP response from the server. The header is buffered,
+     * while the body is passed on, in chunks, as it arrives. The 1xx, 204 and
+     * 304 responses, and the responses to a HEAD, never have a body, whatever
+     * their header says
+     * @param header Where the header is stored
+     * @param on_header Called once the header is complete, before the body
+     * (can be empty)
+     * @param on_body Called for every chunk of the body, after the header is
+     * complete
+     * @param method The method of the request
+     */
+    void receive(std::string& header,
+                 const std::function<void(const Response&)>& on_header,
+                 const BodyHandler& on_body,
+                 std::string_view method = "GET") const {
+        char response[BUFLEN];
+        std::vector<size_t> lines;
+        bool has_length = false;
+        bool keep_alive = true;
+        size_t content_length = 0;
+        size_t header_end = std::string::npos;
+        reusable = false;
+
+        // Here the header is read
+        do {
+            int bytes = read(sockfd, response, BUFLEN);
+            CERR(bytes < 0 && errno != ECONNRESET);
+
+            if (bytes <= 0) {
+                break;
+            }
+
+            // Check if we received all the header data, indexing only the
+            // bytes that were just received
+            size_t scanned = header.size();
+            header.append(response, bytes);
+            header_end =
+                index_header(header.data(), header.size(), lines, scanned);
+
+            if (header_end != std::string::npos) {
+                // The status code tells if there can be a body, and the
+                // fields are looked up without regard to case
+                Response parsed(header.substr(0, header_end));
+                uint code = parsed.get_response_code();
+                bool bodiless = (code >= 100 && code < 200) || code == 204 ||
+                           code == 304 || method == "HEAD";
+                keep_alive = to_lower(parsed.get_header("Connection"))
+                                 .find("close") == std::string::npos;
+
+                std::vector<std::string_view> lengths =
+                    parsed.get_headers("Content-Length");
+                if (lengths.size() != 0) {
+                    has_length = parse_uint_field(lengths[0], content_length);
+                    if (!has_length) {
+                        std::cerr << "Invalid Content-Length received\n";
+                        return;
+                    }
+                }
+
+                if (on_header) {
+                    on_header(parsed);
+                }
+
+                // Otherwise it would be read until the server closes the
+                // connection
+                if (bodiless) {
+                    has_length = true;
+                    content_length = 0;
+                }
+                break;
+            }
+        }
+        FOREVER;
+
+        if (header_end == std::string::npos) {
+            return;
+        }
+
+        // The first bytes of the body came with the header
+        std::string start = header.substr(header_end);
+        header.resize(header_end);
+
+        size_t received = 0;
+        auto consume = [&](const char* data, size_t size) {
+            if (has_length) {
+                size = std::min(size, content_length - received);
+            }
+            if (size != 0) {
+                received += size;
+                on_body(data, size);
+            }
+        };
+        consume(start.data(), start.size());
+
+        // Receive the DATA contained. Without a Content-Length, the body ends
+        // when the server closes the connection
+        while (!has_length || received < content_length) {
+            int bytes = read(sockfd, response, BUFLEN);
+
+            CERR(bytes < 0);
+
+            if (bytes <= 0) {
+                break;
+            }
+
+            consume(response, bytes);
+        }
+
+        reusable = keep_alive && has_length && received == content_length;
+    }
+
+    /**
+     * @brief Receive a HTTP response from the server
+     * @param method The method of the request
+     * @return std::string The response
+     */
+    std::string receive(std::string_view method = "GET") const {
+        std::string response;
+        receive(
+            response, nullptr,
+            [&](const char* data, size_t size) { response.append(data, size); },
+            method);
+
+        // Return the full HTTP Response
+        return response;
+    }
+
+    /**
+     * @brief Receive a HTTP response whose body, if the request succeeded,
+     * is consumed while it arrives. Error bodies are buffered as usual
+     * @param on_header Called once the header of a successful response is
+     * complete, before its body
+     * @param on_body Called for every chunk of a successful body
+     * @return Response The response (without the body, if it was consumed)
+     */
+    Response receive_streamed(
+        const std::function<void(const Response&)>& on_header,
+        const BodyHandler& on_body) const {
+        std::string response;
+        uint code = 0;
+
+        receive(
+            response,
+            [&](const Response& header) {
+                code = header.get_response_code();
+                if (is_code_success(code) && on_header) {
+                    on_header(header);
+                }
+            },
+            [&](const char* data, size_t size) {
+                if (is_code_success(code)) {
+                    on_body(data, size);
+                } else {
+                    response.append(data, size);
+                }
+            });
+
+        return Response(response);
+    }
+
+    ~Connection() { close(); }
+};
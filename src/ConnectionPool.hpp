@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Connection.hpp"
+#include "Request.hpp"
+#include "Response.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief Persistent connections to the REST server, shared by many threads.
+ * A connection is kept open after a response, if the server allows it, and
+ * used by the next request, so most requests don't pay for a TCP handshake
+ */
+class ConnectionPool {
+   private:
+    Endpoint& endpoint;
+    size_t max_idle;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Connection>> idle;
+
+    /**
+     * @brief Take an idle connection. The ones closed by the server while
+     * idle are dropped
+     * @return std::unique_ptr<Connection> The connection, or nullptr
+     */
+    std::unique_ptr<Connection> take_idle() {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (idle.size() != 0) {
+            std::unique_ptr<Connection> connection = std::move(idle.back());
+            idle.pop_back();
+            if (connection->is_alive()) {
+                return connection;
+            }
+        }
+        return nullptr;
+    }
+
+   public:
+    /**
+     * @brief Create an empty pool (the connections are opened when needed)
+     * @param endpoint The address of the server
+     * @param max_idle How many connections are kept open while unused
+     */
+    ConnectionPool(Endpoint& endpoint, const size_t max_idle)
+        : endpoint(endpoint), max_idle(max_idle) {}
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    /**
+     * @brief Get a connection: an idle one, or a new one
+     * @param reused Set if the connection was used before
+     * @return std::unique_ptr<Connection> The connection, or nullptr if the
+     * server can't be reached
+     */
+    std::unique_ptr<Connection> acquire(bool& reused) {
+        std::unique_ptr<Connection> connection = take_idle();
+        reused = connection != nullptr;
+        if (!reused) {
+            connection = std::make_unique<Connection>();
+            if (!connection->try_open(endpoint)) {
+                return nullptr;
+            }
+        }
+        return connection;
+    }
+
+    /**
+     * @brief Open a connection ahead of the first request (the address of
+     * the server is resolved too). A failure is left for the first request
+     * to report
+     */
+    void preconnect() {
+        auto connection = std::make_unique<Connection>();
+        if (!connection->try_open(endpoint)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < max_idle) {
+            idle.push_back(std::move(connection));
+        }
+    }
+
+    /**
+     * @brief Give back a connection. It is closed, unless it can be reused
+     * and the pool has room for it
+     */
+    void release(std::unique_ptr<Connection> connection) {
+        if (!connection->can_reuse()) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < max_idle) {
+            idle.push_back(std::move(connection));
+        }
+    }
+
+    /**
+     * @brief Send a request and receive its response. An idle connection may
+     * have been closed by the server meanwhile; then the request is sent
+     * again, on a new connection, if it didn't reach the server or if it
+     * can be repeated safely. A server that can't be reached gives a
+     * response without a code (0), instead of ending the program
+     * @param request The request
+     * @return Response The response
+     */
+    Response execute(const std::string& request) {
+        FOREVER {
+            std::unique_ptr<Connection> connection = take_idle();
+            bool reused = connection != nullptr;
+            if (!reused) {
+                connection = std::make_unique<Connection>();
+                if (!connection->try_open(endpoint)) {
+                    return Response("");
+                }
+            }
+            bool sent = connection->send(request);
+            std::string response;
+            if (sent) {
+                response = connection->receive(request_method(request));
+            }
+
+            if (response.size() == 0 && reused &&
+                (!sent || can_resend(request))) {
+                continue;
+            }
+
+            Response r(response);
+            release(std::move(connection));
+            return r;
+        }
+    }
+
+    /**
+     * @brief Keep more connections open while unused
+     * @param max The new limit (a lower one is ignored)
+     */
+    void reserve(const size_t max) {
+        std::lock_guard<std::mutex> lock(mutex);
+        max_idle = std::max(max_idle, max);
+    }
+
+    /**
+     * @brief Close the idle connections
+     */
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.clear();
+    }
+};
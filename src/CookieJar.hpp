@@ -0,0 +1,489 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Utils.hpp"
+
+// How many rendered Cookie lines are kept, before they are all dropped
+#define COOKIE_RENDER_CACHE 64
+
+/**
+ * @brief A cookie, as it is stored by a cookie jar (RFC 6265, section 5.3)
+ */
+struct Cookie {
+    std::string name;
+    std::string value;
+    std::string domain;
+    std::string path;
+
+    // When it expires, in seconds since the epoch (0 if it lasts for the
+    // session)
+    lint expires;
+
+    // When it was created, which orders the cookies with the same path
+    lint created;
+
+    // Only sent to the host that set it (there was no Domain attribute)
+    bool host_only;
+    bool secure;
+    bool http_only;
+
+    Cookie()
+        : expires(0),
+          created(0),
+          host_only(true),
+          secure(false),
+          http_only(false) {}
+
+    bool is_expired(const lint now) const {
+        return expires != 0 && expires <= now;
+    }
+};
+
+/**
+ * @brief Parse the date of an Expires attribute. The format of RFC 1123 is
+ * the common one, but the older ones are still used by some servers
+ * @param text The date
+ * @param time The time, in seconds since the epoch
+ * @return true The date is valid
+ * @return false It isn't
+ */
+bool parse_cookie_date(std::string_view text, lint& time) {
+    static const char* formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",  // Sun, 06 Nov 1994 08:49:37 GMT
+        "%a, %d-%b-%Y %H:%M:%S GMT",  // Sun, 06-Nov-1994 08:49:37 GMT
+        "%A, %d-%b-%y %H:%M:%S GMT",  // Sunday, 06-Nov-94 08:49:37 GMT
+        "%a %b %d %H:%M:%S %Y",       // Sun Nov  6 08:49:37 1994
+    };
+
+    std::string date(trim_spaces(text));
+    for (const char* format : formats) {
+        tm parsed;
+        bzero(&parsed, sizeof(parsed));
+        const char* end = strptime(date.c_str(), format, &parsed);
+        if (end != nullptr && *end == 0) {
+            time_t value = timegm(&parsed);
+            time = value > 0 ? value : 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Check if a host is in a domain (RFC 6265, section 5.1.3)
+ */
+bool domain_match(std::string_view host, std::string_view domain) {
+    if (host == domain) {
+        return true;
+    }
+
+    // IP addresses only match themselves
+    in_addr address;
+    return host.size() > domain.size() &&
+           host.substr(host.size() - domain.size()) == domain &&
+           host[host.size() - domain.size() - 1] == '.' &&
+           inet_pton(AF_INET, std::string(host).c_str(), &address) != 1;
+}
+
+/**
+ * @brief Check if the path of a request is in the path of a cookie (RFC
+ * 6265, section 5.1.4)
+ */
+bool path_match(std::string_view request_path, std::string_view cookie_path) {
+    if (request_path.compare(0, cookie_path.size(), cookie_path) != 0) {
+        return false;
+    }
+    return request_path.size() == cookie_path.size() ||
+           cookie_path.back() == '/' || request_path[cookie_path.size()] == '/';
+}
+
+/**
+ * @brief The path of the cookies without a Path attribute: the directory of
+ * the request (RFC 6265, section 5.1.4)
+ */
+std::string default_cookie_path(std::string_view request_path) {
+    request_path = request_path.substr(0, request_path.find('?'));
+    std::size_t last = request_path.rfind('/');
+    if (request_path.size() == 0 || request_path[0] != '/' || last == 0) {
+        return "/";
+    }
+    return std::string(request_path.substr(0, last));
+}
+
+/**
+ * @brief A Cookie line, rendered for a host and a path
+ */
+struct RenderedCookies {
+    std::string host;
+    std::string path;
+    bool secure;
+    std::string line;
+};
+
+/**
+ * @brief The Cookie lines rendered from a version of a jar, by host and path.
+ * They are valid until the first cookie expires
+ */
+struct RenderedJar {
+    std::unordered_map<std::string, RenderedCookies> lines;
+    lint until;
+
+    RenderedJar() : until(0) {}
+};
+
+/**
+ * @brief The cookies received from the servers. They are indexed by domain,
+ * so only the cookies of the host (and of its parent domains) are looked at
+ * when a request is made. The Cookie lines are rendered again when the jar
+ * changes, and published as an immutable snapshot, so building a request
+ * doesn't take a lock
+ */
+class CookieJar {
+   public:
+    using Rendered = std::shared_ptr<const RenderedJar>;
+
+   private:
+    // The cookies, by their domain
+    std::unordered_map<std::string, std::vector<Cookie>> domains;
+
+    // The Cookie lines of the current version of the jar. Only ever replaced
+    // as a whole
+    mutable Rendered rendered;
+
+    lint created;
+
+    /**
+     * @brief The first time a cookie of the jar expires, after now (0 if
+     * never)
+     */
+    lint first_expiry(const lint now) const {
+        lint first = 0;
+        for (auto& domain : domains) {
+            for (auto& cookie : domain.second) {
+                if (cookie.expires > now &&
+                    (first == 0 || cookie.expires < first)) {
+                    first = cookie.expires;
+                }
+            }
+        }
+        return first;
+    }
+
+    /**
+     * @brief Render the Cookie line of a request (RFC 6265, section 5.4):
+     * the cookies with longer paths come first, then the older ones
+     */
+    std::string render(const std::string& host, std::string_view request_path,
+                       const bool secure, const lint now) const {
+        // The cookies of the host, and of every domain it is part of
+        std::string lower_host = to_lower(host);
+        std::vector<const Cookie*> selected;
+        std::string_view domain = lower_host;
+        FOREVER {
+            auto it = domains.find(std::string(domain));
+            if (it != domains.end()) {
+                for (auto& cookie : it->second) {
+                    if ((!cookie.host_only || domain == lower_host) &&
+                        domain_match(lower_host, cookie.domain) &&
+                        path_match(request_path, cookie.path) &&
+                        (secure || !cookie.secure) && !cookie.is_expired(now)) {
+                        selected.push_back(&cookie);
+                    }
+                }
+            }
+
+            std::size_t dot = domain.find('.');
+            if (dot == std::string_view::npos) {
+                break;
+            }
+            domain.remove_prefix(dot + 1);
+        }
+
+        std::sort(selected.begin(), selected.end(),
+                  [](const Cookie* a, const Cookie* b) {
+                      if (a->path.size() != b->path.size()) {
+                          return a->path.size() > b->path.size();
+                      }
+                      return a->created < b->created;
+                  });
+
+        std::string line;
+        for (auto cookie : selected) {
+            if (line.size() != 0) {
+                line.append("; ");
+            }
+            line.append(cookie->name).append("=").append(cookie->value);
+        }
+        return line;
+    }
+
+    /**
+     * @brief Render again the lines that were asked for, and publish them
+     */
+    void changed(const lint now) {
+        Rendered previous = std::atomic_load(&rendered);
+        auto next = std::make_shared<RenderedJar>();
+        next->until = first_expiry(now);
+        for (auto& entry : previous->lines) {
+            RenderedCookies cookies = entry.second;
+            cookies.line =
+                render(cookies.host, cookies.path, cookies.secure, now);
+            next->lines.emplace(entry.first, std::move(cookies));
+        }
+        std::atomic_store(&rendered, Rendered(next));
+    }
+
+   public:
+    CookieJar() : rendered(std::make_shared<const RenderedJar>()), created(0) {}
+
+    // The rendered lines are immutable, so a copy shares them
+    CookieJar(const CookieJar& other)
+        : domains(other.domains),
+          rendered(std::atomic_load(&other.rendered)),
+          created(other.created) {}
+
+    CookieJar& operator=(const CookieJar& other) {
+        if (this != &other) {
+            domains = other.domains;
+            created = other.created;
+            std::atomic_store(&rendered, std::atomic_load(&other.rendered));
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Store a cookie (it replaces the one with the same name, domain
+     * and path). An expired cookie removes the one it replaces
+     * @param cookie The cookie
+     * @param now The current time
+     */
+    void store(Cookie cookie, const lint now) {
+        std::string domain = cookie.domain;
+        std::vector<Cookie>& cookies = domains[domain];
+        auto same = std::find_if(cookies.begin(), cookies.end(),
+                                 [&](const Cookie& stored) {
+                                     return stored.name == cookie.name &&
+                                            stored.path == cookie.path;
+                                 });
+
+        if (same != cookies.end()) {
+            // The creation time of the old cookie is kept
+            cookie.created = same->created;
+            cookies.erase(same);
+        } else {
+            cookie.created = ++created;
+        }
+
+        if (!cookie.is_expired(now)) {
+            cookies.push_back(std::move(cookie));
+        }
+        if (cookies.size() == 0) {
+            domains.erase(domain);
+        }
+        changed(now);
+    }
+
+    /**
+     * @brief Parse a Set-Cookie line, and store its cookie (RFC 6265,
+     * section 5.2). Cookies that the host isn't allowed to set are ignored
+     * @param line The value of the Set-Cookie field
+     * @param host The host of the request
+     * @param request_path The path of the request
+     * @param now The current time
+     * @return true The cookie was stored
+     * @return false It was ignored
+     */
+    bool set_cookie(std::string_view line, const std::string& host,
+                    std::string_view request_path, const lint now) {
+        std::string_view pair = line.substr(0, line.find(';'));
+        std::size_t equal = pair.find('=');
+        if (equal == std::string_view::npos) {
+            return false;
+        }
+
+        Cookie cookie;
+        cookie.name = std::string(trim_spaces(pair.substr(0, equal)));
+        cookie.value = std::string(trim_spaces(pair.substr(equal + 1)));
+        if (cookie.name.size() == 0) {
+            return false;
+        }
+
+        bool has_max_age = false;
+        std::string domain;
+        std::size_t pos = line.find(';');
+        while (pos != std::string_view::npos) {
+            std::string_view attribute = line.substr(pos + 1);
+            pos = line.find(';', pos + 1);
+            attribute = attribute.substr(0, attribute.find(';'));
+
+            std::size_t separator = attribute.find('=');
+            std::string name = to_lower(trim_spaces(attribute.substr(
+                0, separator == std::string_view::npos ? attribute.size()
+                                                      : separator)));
+            std::string_view value =
+                separator == std::string_view::npos
+                    ? ""
+                    : trim_spaces(attribute.substr(separator + 1));
+
+            if (name == "max-age") {
+                // A negative or zero age expires the cookie right away
+                lint age;
+                if (value.size() != 0 && value[0] == '-') {
+                    has_max_age = true;
+                    cookie.expires = 1;
+                } else if (parse_uint_field(value, age)) {
+                    has_max_age = true;
+                    cookie.expires = age == 0 ? 1 : now + age;
+                }
+            } else if (name == "expires" && !has_max_age) {
+                lint time;
+                if (parse_cookie_date(value, time)) {
+                    cookie.expires = time;
+                }
+            } else if (name == "domain" && value.size() != 0) {
+                if (value[0] == '.') {
+                    value.remove_prefix(1);
+                }
+                domain = to_lower(value);
+            } else if (name == "path") {
+                cookie.path = std::string(value);
+            } else if (name == "secure") {
+                cookie.secure = true;
+            } else if (name == "httponly") {
+                cookie.http_only = true;
+            }
+        }
+
+        std::string lower_host = to_lower(host);
+        if (domain.size() != 0) {
+            if (!domain_match(lower_host, domain)) {
+                return false;
+            }
+            cookie.domain = domain;
+            cookie.host_only = false;
+        } else {
+            cookie.domain = lower_host;
+        }
+
+        if (cookie.path.size() == 0 || cookie.path[0] != '/') {
+            cookie.path = default_cookie_path(request_path);
+        }
+
+        store(std::move(cookie), now);
+        return true;
+    }
+
+    /**
+     * @brief Get the value of a cookie
+     * @param name The name of the cookie
+     * @param now The current time
+     * @return std::string The value ("" if there is no such cookie)
+     */
+    std::string value(std::string_view name, const lint now) const {
+        for (auto& domain : domains) {
+            for (auto& cookie : domain.second) {
+                if (cookie.name == name && !cookie.is_expired(now)) {
+                    return cookie.value;
+                }
+            }
+        }
+        return "";
+    }
+
+    /**
+     * @brief Remove the cookies that expired
+     */
+    void remove_expired(const lint now) {
+        for (auto it = domains.begin(); it != domains.end();) {
+            std::vector<Cookie>& cookies = it->second;
+            cookies.erase(std::remove_if(cookies.begin(), cookies.end(),
+                                         [&](const Cookie& cookie) {
+                                             return cookie.is_expired(now);
+                                         }),
+                          cookies.end());
+            it = cookies.size() == 0 ? domains.erase(it) : std::next(it);
+        }
+        changed(now);
+    }
+
+    /**
+     * @brief Call handler for every cookie of the jar
+     */
+    void for_each(const std::function<void(const Cookie&)>& handler) const {
+        for (auto& domain : domains) {
+            for (auto& cookie : domain.second) {
+                handler(cookie);
+            }
+        }
+    }
+
+    /**
+     * @brief Get the Cookie line of a request. A line is rendered the first
+     * time it is asked for, and then again only when the jar changes
+     * @param host The host of the request
+     * @param request_path The path of the request
+     * @param secure The request is sent over a secure channel
+     * @param now The current time
+     * @return std::string The value of the Cookie field ("" if no cookies
+     * are sent)
+     */
+    std::string header(const std::string& host, std::string_view request_path,
+                       const bool secure, const lint now) const {
+        if (domains.size() == 0) {
+            return "";
+        }
+
+        request_path = request_path.substr(0, request_path.find('?'));
+        std::string key = host;
+        key.append(secure ? " s " : " - ").append(request_path);
+
+        Rendered current = std::atomic_load(&rendered);
+        bool expired = current->until != 0 && now >= current->until;
+        if (!expired) {
+            auto it = current->lines.find(key);
+            if (it != current->lines.end()) {
+                return it->second.line;
+            }
+        }
+
+        // The line is added to a copy of the snapshot, which is only
+        // published if the jar didn't change meanwhile
+        RenderedCookies cookies;
+        cookies.host = host;
+        cookies.path = std::string(request_path);
+        cookies.secure = secure;
+        cookies.line = render(host, request_path, secure, now);
+
+        auto next = std::make_shared<RenderedJar>();
+        if (expired || current->lines.size() >= COOKIE_RENDER_CACHE) {
+            next->until = first_expiry(now);
+        } else {
+            *next = *current;
+        }
+        next->lines.emplace(key, cookies);
+        std::atomic_compare_exchange_strong(&rendered, &current,
+                                            Rendered(next));
+        return cookies.line;
+    }
+};
@@ -0,0 +1,329 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <fstream>
+#include "CookieJar.hpp"
+#include "JsonReader.hpp"
+#include "Utils.hpp"
+
+#define CREDENTIALS_MAGIC "RCPPCRED"
+#define CREDENTIALS_VERSION 2
+
+/**
+ * @brief Decode a base64url string (with or without the padding)
+ * @param text The encoded string
+ * @param out Where the decoded bytes are stored
+ * @return true The string is valid base64url
+ * @return false It isn't
+ */
+bool decode_base64url(std::string_view text, std::string& out) {
+    out.clear();
+    uint bits = 0;
+    int count = 0;
+
+    for (char c : text) {
+        uint value;
+        if (c >= 'A' && c <= 'Z') {
+            value = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            value = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            value = c - '0' + 52;
+        } else if (c == '-' || c == '+') {
+            value = 62;
+        } else if (c == '_' || c == '/') {
+            value = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            return false;
+        }
+
+        bits = (bits << 6) | value;
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            out.push_back((char)((bits >> count) & 0xFF));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Find when a JWT expires, from the "exp" claim of its payload. The
+ * signature isn't checked, as the token is only read to know when it has to
+ * be replaced
+ * @param token The JWT
+ * @return lint The expiry time, in seconds since the epoch (0 if unknown)
+ */
+lint jwt_expiry(std::string_view token) {
+    std::size_t first = token.find('.');
+    if (first == std::string_view::npos) {
+        return 0;
+    }
+    std::size_t second = token.find('.', first + 1);
+    if (second == std::string_view::npos) {
+        return 0;
+    }
+
+    std::string payload;
+    lint expiry;
+    if (!decode_base64url(token.substr(first + 1, second - first - 1),
+                          payload) ||
+        !read_uint_field(payload, "exp", expiry)) {
+        return 0;
+    }
+    return expiry;
+}
+
+/**
+ * @brief The credentials of a user, which are saved between the runs, so the
+ * login and the access to the library don't have to be repeated
+ */
+struct Credentials {
+    std::string username;
+
+    // The cookies set by the server, the session cookie among them
+    CookieJar cookies;
+
+    // The JWT of the library, and when it expires (0 if unknown)
+    std::string token;
+    lint token_expires;
+
+    Credentials() : token_expires(0) {}
+
+    /**
+     * @brief The value of the session cookie ("" if there is no session)
+     */
+    std::string session_id() const {
+        return cookies.value(SESSION_COOKIE, unix_now());
+    }
+
+    /**
+     * @brief Drop the cookies that expired. The token only goes with the
+     * session, as an expired token can be replaced using the session
+     */
+    void drop_expired(const lint now) {
+        cookies.remove_expired(now);
+        if (cookies.value(SESSION_COOKIE, now) == "") {
+            token = "";
+            token_expires = 0;
+        }
+    }
+};
+
+/**
+ * @brief Credentials shared by many threads. They are never changed in place:
+ * the readers get an immutable snapshot, without taking a lock, and a writer
+ * replaces the whole snapshot at once, so a request is never built with the
+ * session of one login and the token of another
+ */
+class SharedCredentials {
+   public:
+    using Snapshot = std::shared_ptr<const Credentials>;
+
+   private:
+    Snapshot current;
+
+   public:
+    SharedCredentials() : current(std::make_shared<const Credentials>()) {}
+
+    SharedCredentials(const SharedCredentials&) = delete;
+    SharedCredentials& operator=(const SharedCredentials&) = delete;
+
+    /**
+     * @brief The current credentials (they stay valid while they are used,
+     * even if they are replaced meanwhile)
+     */
+    Snapshot load() const { return std::atomic_load(&current); }
+
+    /**
+     * @brief Replace the credentials
+     */
+    void store(const Credentials& credentials) {
+        std::atomic_store(&current,
+                          Snapshot(std::make_shared<Credentials>(credentials)));
+    }
+
+    /**
+     * @brief Replace the credentials, only if they weren't replaced since
+     * expected was loaded
+     * @param expected The credentials that are replaced (updated to the
+     * current ones if the replacement fails)
+     * @param credentials The new credentials
+     * @return true They were replaced
+     * @return false Someone else replaced them first
+     */
+    bool replace(Snapshot& expected, const Credentials& credentials) {
+        return std::atomic_compare_exchange_strong(
+            &current, &expected,
+            Snapshot(std::make_shared<Credentials>(credentials)));
+    }
+};
+
+/**
+ * @brief Check that a value can be written on a line of the credentials file
+ */
+bool is_credential_value(const std::string& value) {
+    return std::none_of(value.begin(), value.end(), [](unsigned char c) {
+        return std::isspace(c) || std::iscntrl(c);
+    });
+}
+
+/**
+ * @brief Save the credentials in a file that only the user can read. The file
+ * is replaced atomically, so it is never seen half written
+ * @param path The file
+ * @param credentials The credentials
+ * @return true The file was written
+ * @return false It couldn't be written
+ */
+bool save_credentials(const std::string& path, const Credentials& credentials) {
+    if (!is_credential_value(credentials.username) ||
+        !is_credential_value(credentials.token)) {
+        return false;
+    }
+
+    std::stringstream ss;
+    ss << CREDENTIALS_MAGIC << " " << CREDENTIALS_VERSION << "\n";
+    ss << "user " << credentials.username << "\n";
+    ss << "token " << credentials.token_expires << " " << credentials.token
+       << "\n";
+
+    // The cookies are written in the order they were created, so the next
+    // run orders them the same way (the ones that can't be written on a
+    // line are left out)
+    std::vector<const Cookie*> cookies;
+    credentials.cookies.for_each(
+        [&](const Cookie& cookie) { cookies.push_back(&cookie); });
+    std::sort(cookies.begin(), cookies.end(),
+              [](const Cookie* a, const Cookie* b) {
+                  return a->created < b->created;
+              });
+    for (auto cookie : cookies) {
+        if (!is_credential_value(cookie->domain) ||
+            !is_credential_value(cookie->path) ||
+            !is_credential_value(cookie->name) ||
+            !is_credential_value(cookie->value)) {
+            continue;
+        }
+
+        std::string flags;
+        flags.append(cookie->host_only ? "h" : "");
+        flags.append(cookie->secure ? "s" : "");
+        flags.append(cookie->http_only ? "p" : "");
+        ss << "cookie " << cookie->expires << " "
+           << (flags.size() != 0 ? flags : "-") << " " << cookie->domain << " "
+           << cookie->path << " " << cookie->name << " " << cookie->value
+           << "\n";
+    }
+    std::string content = ss.str();
+
+    std::string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool written =
+        write(fd, content.data(), content.size()) == (ssize_t)content.size();
+    close(fd);
+
+    if (!written || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Load the credentials saved by a previous run. A file that can be
+ * read by other users is ignored
+ * @param path The file
+ * @param credentials Where the credentials are stored
+ * @return true The file is valid
+ * @return false It is missing, unsafe or malformed
+ */
+bool load_credentials(const std::string& path, Credentials& credentials) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode) ||
+        info.st_uid != getuid() || (info.st_mode & 077) != 0) {
+        return false;
+    }
+
+    std::ifstream in(path);
+    std::string magic;
+    uint version;
+    Credentials loaded;
+
+    if (!(in >> magic >> version) || magic != CREDENTIALS_MAGIC ||
+        version != CREDENTIALS_VERSION) {
+        return false;
+    }
+
+    // The values can be empty, so every line is read on its own
+    std::string line;
+    std::getline(in, line);
+    if (!std::getline(in, line) || line.compare(0, 5, "user ") != 0) {
+        return false;
+    }
+    loaded.username = line.substr(5);
+
+    if (!std::getline(in, line) || line.compare(0, 6, "token ") != 0) {
+        return false;
+    }
+    std::string_view token(line);
+    token.remove_prefix(6);
+    std::size_t space = token.find(' ');
+    if (space == std::string_view::npos ||
+        !parse_uint_field(token.substr(0, space), loaded.token_expires)) {
+        return false;
+    }
+    loaded.token = std::string(token.substr(space + 1));
+
+    lint now = unix_now();
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string kind, flags;
+        Cookie cookie;
+        if (!(fields >> kind >> cookie.expires >> flags >> cookie.domain >>
+              cookie.path >> cookie.name) ||
+            kind != "cookie") {
+            return false;
+        }
+
+        // The value can be empty
+        fields.get();
+        std::getline(fields, cookie.value);
+        cookie.host_only = flags.find('h') != std::string::npos;
+        cookie.secure = flags.find('s') != std::string::npos;
+        cookie.http_only = flags.find('p') != std::string::npos;
+        loaded.cookies.store(cookie, now);
+    }
+
+    credentials = loaded;
+    return true;
+}
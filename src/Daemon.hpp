@@ -0,0 +1,297 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "Utils.hpp"
+
+/**
+ * @brief The socket of the daemon of a server
+ * @param host The host of the server
+ * @param port The port of the server
+ * @return std::string The path of the socket ("" if there is no daemon)
+ */
+std::string daemon_path(const std::string& host, const int port) {
+    if (std::string(DAEMON_SOCKET) == "") {
+        return "";
+    }
+    return std::string(DAEMON_SOCKET) + "." + host + "." + std::to_string(port);
+}
+
+/**
+ * @brief The address of a UNIX socket
+ * @param path The path of the socket
+ * @param address Where the address is stored
+ * @return true The path fits in the address
+ * @return false It is too long
+ */
+bool unix_address(const std::string& path, sockaddr_un& address) {
+    bzero(&address, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() == 0 || path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+/**
+ * @brief An output stream buffer that writes on a socket, so the results of
+ * the commands are sent while the next ones run
+ */
+class SocketBuffer : public std::streambuf {
+   private:
+    int fd;
+    char buffer[BUFLEN];
+    bool failed;
+
+   protected:
+    int sync() override {
+        if (!failed && pptr() != pbase()) {
+            failed = !send_all(fd, pbase(), pptr() - pbase());
+        }
+        setp(buffer, buffer + sizeof(buffer));
+        return failed ? -1 : 0;
+    }
+
+    int_type overflow(int_type c) override {
+        if (sync() != 0) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+   public:
+    SocketBuffer(const int fd) : fd(fd), failed(false) {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+
+    ~SocketBuffer() { sync(); }
+};
+
+/**
+ * @brief The socket the daemon listens on. A client connects, sends a script
+ * and shuts down its side; the results are sent back as JSON lines, and the
+ * connection is closed. Only the user that runs the daemon can connect
+ */
+class DaemonSocket {
+   private:
+    std::string path;
+    int fd;
+
+    // A signal (SIGINT, SIGTERM) writes to this pipe, to wake up accept
+    inline static int stop_pipe[2] = {-1, -1};
+
+    static void on_signal(int) {
+        char byte = 0;
+        if (write(stop_pipe[1], &byte, 1) < 0) {
+            // Nothing can be done in a signal handler
+        }
+    }
+
+   public:
+    DaemonSocket() : fd(-1) {}
+
+    DaemonSocket(const DaemonSocket&) = delete;
+    DaemonSocket& operator=(const DaemonSocket&) = delete;
+
+    /**
+     * @brief Start listening. A socket left by a daemon that died is
+     * replaced, but not one that a daemon still listens on
+     * @param file The path of the socket
+     */
+    void open(const std::string& file) {
+        sockaddr_un address;
+        MUST(unix_address(file, address),
+             "Invalid socket path " << file << "\n");
+
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        MUST(probe >= 0, "Couldn't create socket\n");
+        bool running =
+            connect(probe, (sockaddr*)&address, sizeof(address)) == 0;
+        close(probe);
+        MUST(!running, "A daemon already listens on " << file << "\n");
+        unlink(file.c_str());
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        MUST(fd >= 0, "Couldn't create socket\n");
+
+        // The socket is created without any permission for the others
+        mode_t mask = umask(077);
+        int bound = bind(fd, (sockaddr*)&address, sizeof(address));
+        umask(mask);
+        MUST(bound == 0, "Couldn't bind " << file << "\n");
+        MUST(listen(fd, SOMAXCONN) == 0, "Couldn't listen on " << file << "\n");
+        path = file;
+
+        MUST(pipe(stop_pipe) == 0, "Couldn't create pipe\n");
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = on_signal;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+    }
+
+    /**
+     * @brief Wait for a client, and read its script
+     * @param script Where the script is stored
+     * @return int The connection of the client (-1 if the daemon has to stop)
+     */
+    int accept(std::string& script) {
+        FOREVER {
+            pollfd events[2] = {{fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+            if (poll(events, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                CERR(true);
+                return -1;
+            }
+            if (events[1].revents != 0) {
+                return -1;
+            }
+
+            int client = ::accept(fd, nullptr, nullptr);
+            if (client < 0) {
+                continue;
+            }
+
+            // Only the user of the daemon can use its session
+            ucred peer;
+            socklen_t size = sizeof(peer);
+            int found = getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer,
+                                   &size);
+            if (found != 0 || peer.uid != getuid()) {
+                close(client);
+                continue;
+            }
+
+            // A client that stops sending doesn't block the others for long
+            timeval timeout = {DAEMON_TIMEOUT, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                       sizeof(timeout));
+
+            script.clear();
+            char chunk[BUFLEN];
+            ssize_t bytes;
+            while ((bytes = read(client, chunk, sizeof(chunk))) > 0 ||
+                   (bytes < 0 && errno == EINTR)) {
+                script.append(chunk, bytes > 0 ? bytes : 0);
+            }
+            if (bytes < 0) {
+                close(client);
+                continue;
+            }
+            return client;
+        }
+    }
+
+    /**
+     * @brief Stop listening, and remove the socket
+     */
+    void close_socket() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+            unlink(path.c_str());
+        }
+    }
+
+    ~DaemonSocket() { close_socket(); }
+};
+
+/**
+ * @brief Send a script to the daemon, and print its results
+ * @param path The socket of the daemon
+ * @param script The script
+ * @param status Set to the exit code (1 if a command failed, or if the
+ * daemon sent no result)
+ * @return true The daemon ran the script
+ * @return false There is no daemon, so the script has to be run here
+ */
+bool forward_script(const std::string& path, const std::string& script,
+                    int& status) {
+    sockaddr_un address;
+    if (!unix_address(path, address)) {
+        return false;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    MUST(fd >= 0, "Couldn't create socket\n");
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return false;
+    }
+
+    // The end of the script is the end of the request
+    MUST(send_all(fd, script.data(), script.size()),
+         "The daemon closed the connection\n");
+    shutdown(fd, SHUT_WR);
+
+    // Every result is a JSON line, printed as soon as it is received
+    status = 0;
+    size_t results = 0;
+    char chunk[BUFLEN];
+    std::string line;
+    ssize_t bytes;
+    while ((bytes = read(fd, chunk, sizeof(chunk))) > 0 ||
+           (bytes < 0 && errno == EINTR)) {
+        for (ssize_t i = 0; i < bytes; i++) {
+            line.push_back(chunk[i]);
+            if (chunk[i] != '\n') {
+                continue;
+            }
+
+            std::cout << line;
+            json result = json::parse(line, nullptr, false);
+            if (!result.is_object() || !result.value("ok", false)) {
+                status = 1;
+            }
+            results++;
+            line.clear();
+        }
+        std::cout.flush();
+    }
+    close(fd);
+
+    // The daemon died before sending every result
+    if (line != "" || bytes < 0) {
+        std::cout << line;
+        status = 1;
+    }
+
+    // Or it closed the connection without running the script
+    if (results == 0) {
+        std::cerr << "The daemon sent no result\n";
+        status = 1;
+    }
+    return true;
+}
@@ -0,0 +1,241 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <map>
+#include "Book.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief Append a field of a CSV record (RFC 4180). It is quoted only if it
+ * holds commas, quotes or line breaks
+ */
+void append_csv_field(std::string& out, std::string_view text) {
+    if (text.find_first_of(",\"\r\n") == std::string_view::npos) {
+        out.append(text);
+        return;
+    }
+
+    out.push_back('"');
+    for (char c : text) {
+        if (c == '"') {
+            out.push_back('"');
+        }
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+void append_csv_field(std::string& out, const lint value) {
+    out.append(std::to_string(value));
+}
+
+/**
+ * @brief Append the header of a CSV file of books (the names of the fields)
+ */
+void write_csv_header(std::string& out) {
+    std::string_view separator = "";
+#define BOOK_CSV_NAME(type, name, sent) \
+    out.append(separator);              \
+    out.append(#name);                  \
+    separator = ",";
+    BOOK_FIELDS(BOOK_CSV_NAME)
+#undef BOOK_CSV_NAME
+    out.append(ENDL);
+}
+
+/**
+ * @brief Append a book as a record of a CSV file, with all its fields
+ */
+void write_csv_book(std::string& out, const Book& book) {
+    std::string_view separator = "";
+#define BOOK_CSV_FIELD(type, name, sent) \
+    out.append(separator);               \
+    append_csv_field(out, book.name);    \
+    separator = ",";
+    BOOK_FIELDS(BOOK_CSV_FIELD)
+#undef BOOK_CSV_FIELD
+    out.append(ENDL);
+}
+
+/**
+ * @brief Writes the records of an export to a file, on its own thread. The
+ * records are produced out of order, by many threads, so they wait in a
+ * reorder buffer until the ones before them are written; the file is written
+ * in big blocks
+ */
+class OrderedWriter {
+   public:
+    /**
+     * @brief Called on the writer thread, after a block is written
+     * @param last The sequence number of the last record that was written
+     * @param offset The size of the file
+     */
+    using OnFlush = std::function<void(lint last, lint offset)>;
+
+   private:
+    int fd;
+    lint offset;
+    OnFlush on_flush;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // The records that wait for the ones before them
+    std::map<lint, std::string> pending;
+    lint next;
+    bool closing;
+    bool failed;
+    std::thread worker;
+
+    /**
+     * @brief Write a block to the file
+     * @param block The block (emptied)
+     * @param last The sequence number of its last record
+     */
+    void flush(std::string& block, const lint last) {
+        size_t written = 0;
+        while (written < block.size() && !failed) {
+            ssize_t bytes =
+                write(fd, block.data() + written, block.size() - written);
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            CERR(bytes < 0);
+            failed = bytes < 0;
+            written += bytes > 0 ? bytes : 0;
+        }
+
+        offset += written;
+        block.clear();
+        if (!failed && on_flush) {
+            on_flush(last, offset);
+        }
+    }
+
+    void work() {
+        std::string block;
+        block.reserve(EXPORT_BUFFER);
+        lint last = 0;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        FOREVER {
+            changed.wait(lock,
+                         [&] { return closing || pending.count(next) != 0; });
+
+            // The records that are next in order leave the buffer together
+            size_t taken = 0;
+            for (auto it = pending.find(next); it != pending.end();
+                 it = pending.find(next)) {
+                block.append(it->second);
+                pending.erase(it);
+                last = next++;
+                taken++;
+            }
+            if (taken == 0 && closing) {
+                break;
+            }
+            changed.notify_all();
+
+            if (block.size() >= EXPORT_BUFFER) {
+                lock.unlock();
+                flush(block, last);
+                lock.lock();
+            }
+        }
+
+        if (block.size() != 0) {
+            flush(block, last);
+        }
+    }
+
+   public:
+    /**
+     * @brief Start the writer thread
+     * @param fd The file, positioned where the records are written
+     * @param offset The size of the file
+     * @param on_flush Called after every block is written
+     */
+    OrderedWriter(const int fd, const lint offset, OnFlush on_flush)
+        : fd(fd),
+          offset(offset),
+          on_flush(on_flush),
+          next(0),
+          closing(false),
+          failed(false) {
+        worker = std::thread([this] { work(); });
+    }
+
+    OrderedWriter(const OrderedWriter&) = delete;
+    OrderedWriter& operator=(const OrderedWriter&) = delete;
+
+    /**
+     * @brief Hand over a record (from any thread)
+     * @param seq Its sequence number, counted from 0, without gaps
+     * @param record The record ("" to skip it)
+     */
+    void push(const lint seq, std::string record) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.emplace(seq, std::move(record));
+        changed.notify_all();
+    }
+
+    /**
+     * @brief Wait until a number of records left the buffer. Before producing
+     * a record, the producer waits for all but window of the ones before it,
+     * so the buffer can't grow without bound
+     * @param count How many records
+     */
+    void wait_written(const lint count) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return next >= count; });
+    }
+
+    /**
+     * @brief How many records have left the buffer
+     */
+    lint written() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return next;
+    }
+
+    /**
+     * @brief Write the rest of the records, and stop the thread. Every record
+     * before the last one has to be pushed first
+     * @return true Everything was written
+     * @return false The file couldn't be written
+     */
+    bool close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        changed.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        return !failed;
+    }
+
+    ~OrderedWriter() { close(); }
+};
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <fstream>
+#include "Book.hpp"
+#include "Utils.hpp"
+
+// The longest a record of a CSV file can be, in bytes, when a quoted field
+// spans many lines
+#define MAX_CSV_RECORD (1 << 20)
+
+/**
+ * @brief Read a record of a CSV file (RFC 4180). A quoted field can hold
+ * commas, doubled quotes and line breaks, so a record can span many lines.
+ * A quote that isn't closed before the end of the file, or before the record
+ * gets to MAX_CSV_RECORD bytes, only takes its own line: the file is read
+ * again from the next one
+ * @param in The file
+ * @param fields Where the fields are stored
+ * @param line The number of the last line that was read (updated)
+ * @param complete Cleared if the record has a quote that isn't closed
+ * @return true A record was read
+ * @return false The file ended
+ */
+bool read_csv_record(std::istream& in, std::vector<std::string>& fields,
+                     lint& line, bool& complete) {
+    std::string text;
+    if (!std::getline(in, text)) {
+        return false;
+    }
+    line++;
+    complete = true;
+
+    // Where the record would end, if its quote is never closed
+    std::streampos next_line = in.tellg();
+    lint first_line = line;
+    size_t size = text.size();
+
+    fields.clear();
+    fields.emplace_back();
+    bool quoted = false;
+    FOREVER {
+        for (size_t i = 0; i < text.size(); i++) {
+            char c = text[i];
+            if (quoted) {
+                if (c != '"') {
+                    fields.back().push_back(c);
+                } else if (i + 1 < text.size() && text[i + 1] == '"') {
+                    fields.back().push_back('"');
+                    i++;
+                } else {
+                    quoted = false;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ',') {
+                fields.emplace_back();
+            } else if (c != '\r' || i + 1 != text.size()) {
+                fields.back().push_back(c);
+            }
+        }
+
+        // A line break inside quotes is part of the field
+        if (!quoted) {
+            return true;
+        }
+        if (!std::getline(in, text) ||
+            (size += text.size() + 1) > MAX_CSV_RECORD) {
+            in.clear();
+            in.seekg(next_line);
+            line = first_line;
+            complete = false;
+            return true;
+        }
+        line++;
+        fields.back().push_back('\n');
+    }
+}
+
+/**
+ * @brief Reads the books to import from a file, one at a time, so the file
+ * never has to fit in memory. A CSV file (.csv) starts with a header that
+ * names the fields of its columns; any other file is read as JSON Lines, one
+ * book object per line
+ */
+class ImportReader {
+   private:
+    std::ifstream in;
+    bool csv;
+    std::vector<std::string> columns;
+    std::vector<std::string> fields;
+    std::string text;
+    lint line;
+
+   public:
+    ImportReader() : csv(false), line(0) {}
+
+    /**
+     * @brief Open a file
+     * @param path The file
+     * @param error Why the file can't be read
+     * @return true The file can be read
+     * @return false It can't
+     */
+    bool open(const std::string& path, std::string& error) {
+        in.open(path);
+        if (!in) {
+            error = "Couldn't open " + path;
+            return false;
+        }
+
+        csv = has_extension(path, ".csv");
+        if (!csv) {
+            return true;
+        }
+
+        bool complete;
+        if (!read_csv_record(in, columns, line, complete)) {
+            error = "The file is empty";
+            return false;
+        }
+        if (!complete) {
+            error = "Unterminated quote on line " + std::to_string(line);
+            return false;
+        }
+        for (auto& column : columns) {
+            Book book;
+            column = to_lower(trim_spaces(column));
+            if (!set_book_field(book, column, "0")) {
+                error = "Unknown column: " + column;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Read the next book
+     * @param book Where the book is stored
+     * @param valid Set if the record is a valid book
+     * @param record_line The line where the record starts
+     * @return true A record was read
+     * @return false The file ended
+     */
+    bool next(Book& book, bool& valid, lint& record_line) {
+        book = Book();
+        valid = true;
+
+        if (csv) {
+            bool complete;
+            do {
+                record_line = line + 1;
+                if (!read_csv_record(in, fields, line, complete)) {
+                    return false;
+                }
+            } while (complete && fields.size() == 1 && fields[0].size() == 0);
+
+            if (!complete || fields.size() != columns.size()) {
+                valid = false;
+                return true;
+            }
+            for (size_t i = 0; i < fields.size() && valid; i++) {
+                valid = set_book_field(book, columns[i], fields[i]);
+            }
+            return true;
+        }
+
+        // JSON Lines, where the empty lines are skipped
+        do {
+            if (!std::getline(in, text)) {
+                return false;
+            }
+            record_line = ++line;
+        } while (trim_spaces(text).size() == 0);
+
+        std::vector<Book> books;
+        valid = read_books(text, books) && books.size() == 1;
+        if (valid) {
+            book = std::move(books[0]);
+        }
+        return true;
+    }
+};
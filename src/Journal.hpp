@@ -0,0 +1,223 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <fstream>
+#include "Utils.hpp"
+
+#define JOURNAL_MAGIC "RCPPJRNL"
+#define JOURNAL_VERSION 1
+
+/**
+ * @brief Describe the version of a file (its size and the time it was last
+ * changed), so a journal isn't applied to a file that was edited meanwhile
+ * @param path The file
+ * @return std::string The version ("" if the file can't be read)
+ */
+std::string file_version(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return "";
+    }
+    return std::to_string(info.st_size) + " " +
+           std::to_string(info.st_mtim.tv_sec) + "." +
+           std::to_string(info.st_mtim.tv_nsec);
+}
+
+/**
+ * @brief The progress of a bulk job, in an append-only file: a line when an
+ * item is started ("S <key>"), and one when it is done ("D <key>"). If the
+ * job is interrupted, running it again skips the items that were done. The
+ * items that were started but not done may have reached the server, so the
+ * job has to check them before sending them again. A job that handles its
+ * items in order can instead record checkpoints ("C <key> <offset>"): every
+ * item up to the key is done, and its output ends at the offset
+ */
+class Journal {
+   private:
+    std::string path;
+    int fd;
+
+    std::unordered_set<lint> started;
+    std::unordered_set<lint> done;
+
+    // The last checkpoint (0 if there is none)
+    lint checkpoint_key;
+    lint checkpoint_offset;
+
+    void append(const char kind, const lint key,
+                const std::string& extra = "") {
+        if (fd < 0) {
+            return;
+        }
+
+        // A single write, so a crash never leaves half of a line (the process
+        // can die at any point, but the kernel keeps what was written)
+        std::string line;
+        line.push_back(kind);
+        line.push_back(' ');
+        line.append(std::to_string(key));
+        if (extra != "") {
+            line.push_back(' ');
+            line.append(extra);
+        }
+        line.push_back('\n');
+        CERR(write(fd, line.data(), line.size()) != (ssize_t)line.size());
+    }
+
+   public:
+    Journal() : fd(-1), checkpoint_key(0), checkpoint_offset(0) {}
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /**
+     * @brief Open the journal of a job. The progress of a previous run is
+     * loaded only if it belongs to the same job; otherwise the journal is
+     * started over
+     * @param file The file
+     * @param job What identifies the job (like its kind, its input and the
+     * user), on a single line
+     * @return true The progress of a previous run was loaded
+     * @return false The job starts from the beginning
+     */
+    bool open(const std::string& file, const std::string& job) {
+        path = file;
+        started.clear();
+        done.clear();
+        checkpoint_key = checkpoint_offset = 0;
+
+        std::ifstream in(path);
+        std::string line;
+        std::string header =
+            std::string(JOURNAL_MAGIC) + " " +
+            std::to_string(JOURNAL_VERSION) + " " + job;
+        bool resumed = std::getline(in, line) && !in.eof() && line == header;
+        std::streamoff valid_end = resumed ? (std::streamoff)in.tellg() : 0;
+        if (resumed) {
+            // A malformed or unfinished line can only be the last one, of a
+            // run that died while writing it
+            while (std::getline(in, line) && !in.eof()) {
+                std::string_view text(line);
+                std::size_t space = text.find(' ', 2);
+                lint key, offset = 0;
+                if (line.size() < 3 || line[1] != ' ' ||
+                    !parse_uint_field(text.substr(2, space - 2), key) ||
+                    (space != std::string_view::npos &&
+                     !parse_uint_field(text.substr(space + 1), offset))) {
+                    break;
+                }
+                if (line[0] == 'S') {
+                    started.insert(key);
+                } else if (line[0] == 'D') {
+                    done.insert(key);
+                } else if (line[0] == 'C') {
+                    checkpoint_key = key;
+                    checkpoint_offset = offset;
+                }
+                valid_end = in.tellg();
+            }
+        }
+        in.close();
+
+        // The torn line is cut off, so the next ones start on a line of their
+        // own
+        int flags = O_WRONLY | O_CREAT | O_APPEND | (resumed ? 0 : O_TRUNC);
+        fd = ::open(path.c_str(), flags, 0600);
+        if (fd >= 0 && resumed) {
+            CERR(ftruncate(fd, valid_end) != 0);
+        }
+        if (fd >= 0 && !resumed) {
+            header.push_back('\n');
+            CERR(write(fd, header.data(), header.size()) !=
+                 (ssize_t)header.size());
+        }
+        return resumed &&
+               done.size() + started.size() + checkpoint_key != 0;
+    }
+
+    /**
+     * @brief If an item was done by a previous run
+     */
+    bool is_done(const lint key) const { return done.count(key) != 0; }
+
+    /**
+     * @brief If an item was started by a previous run, which died before it
+     * was known to be done
+     */
+    bool is_uncertain(const lint key) const {
+        return started.count(key) != 0 && done.count(key) == 0;
+    }
+
+    /**
+     * @brief How many items were done by the previous runs
+     */
+    size_t completed() const { return done.size(); }
+
+    /**
+     * @brief Record that an item is started, before its request is sent
+     */
+    void start(const lint key) { append('S', key); }
+
+    /**
+     * @brief Record that an item is done
+     */
+    void finish(const lint key) { append('D', key); }
+
+    /**
+     * @brief Record that every item up to a key is done, and that the output
+     * ends at an offset
+     */
+    void checkpoint(const lint key, const lint offset) {
+        append('C', key, std::to_string(offset));
+    }
+
+    /**
+     * @brief The key of the last checkpoint (0 if there is none)
+     */
+    lint last_key() const { return checkpoint_key; }
+
+    /**
+     * @brief Where the output ended, at the last checkpoint
+     */
+    lint last_offset() const { return checkpoint_offset; }
+
+    /**
+     * @brief The job is over: the journal isn't needed anymore
+     */
+    void remove() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        unlink(path.c_str());
+    }
+
+    ~Journal() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
@@ -0,0 +1,456 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Utils.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_READER_SSE2 1
+#endif
+
+/**
+ * @brief Find the first byte that ends the plain part of a JSON string: a
+ * quote, a backslash or a control character
+ * @param from Where the search starts
+ * @param end The end of the input
+ * @return const char* The byte (or end)
+ */
+const char* find_string_special(const char* from, const char* end) {
+#ifdef JSON_READER_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    // Unsigned "lower than 0x20" is min(v, 0x1F) == v
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    for (; end - from >= 16; from += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)from);
+        __m128i special = _mm_or_si128(
+            _mm_cmpeq_epi8(_mm_min_epu8(v, control), v),
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                         _mm_cmpeq_epi8(v, backslash)));
+        uint mask = _mm_movemask_epi8(special);
+        if (mask) {
+            return from + __builtin_ctz(mask);
+        }
+    }
+#endif
+    while (from != end && *from != '"' && *from != '\\' &&
+           (uchar)*from >= 0x20) {
+        from++;
+    }
+    return from;
+}
+
+/**
+ * @brief Find the first structural byte outside of a string: a bracket, a
+ * quote (the start of a string) or a comma
+ * @param from Where the search starts
+ * @param end The end of the input
+ * @return const char* The byte (or end)
+ */
+const char* find_structural(const char* from, const char* end) {
+#ifdef JSON_READER_SSE2
+    // Setting the 0x20 bit turns '[' into '{' and ']' into '}'
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i comma = _mm_set1_epi8(',');
+
+    for (; end - from >= 16; from += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)from);
+        __m128i folded = _mm_or_si128(v, lower);
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                         _mm_cmpeq_epi8(folded, close)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, comma)));
+        uint mask = _mm_movemask_epi8(special);
+        if (mask) {
+            return from + __builtin_ctz(mask);
+        }
+    }
+#endif
+    while (from != end && *from != '{' && *from != '}' && *from != '[' &&
+           *from != ']' && *from != '"' && *from != ',') {
+        from++;
+    }
+    return from;
+}
+
+/**
+ * @brief Skip the rest of a string, without decoding it
+ * @param from The byte after the opening quote
+ * @param end The end of the input
+ * @return const char* The byte after the closing quote (or end)
+ */
+const char* skip_string(const char* from, const char* end) {
+    FOREVER {
+        from = find_string_special(from, end);
+        if (from == end) {
+            return end;
+        } else if (*from == '"') {
+            return from + 1;
+        } else if (*from == '\\') {
+            from += std::min<size_t>(2, end - from);
+        } else {
+            from++;
+        }
+    }
+}
+
+/**
+ * @brief A forward-only reader over a JSON document. Values are read (or
+ * skipped) in the order they appear, without building a DOM; every method
+ * returns false if the input doesn't have the expected shape
+ */
+class JsonReader {
+   private:
+    const char* pos;
+    const char* end;
+
+    static bool is_space(const char c) {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    /**
+     * @brief Read the 4 hex digits of a \u escape
+     */
+    bool read_hex(uint& value) {
+        if (end - pos < 4) {
+            return false;
+        }
+
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = *pos++;
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                value |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                value |= c - 'A' + 10;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Decode an escape sequence (the backslash was consumed)
+     */
+    bool read_escape(std::string& out) {
+        if (pos == end) {
+            return false;
+        }
+
+        switch (*pos++) {
+            case '"':
+                out.push_back('"');
+                return true;
+            case '\\':
+                out.push_back('\\');
+                return true;
+            case '/':
+                out.push_back('/');
+                return true;
+            case 'b':
+                out.push_back('\b');
+                return true;
+            case 'f':
+                out.push_back('\f');
+                return true;
+            case 'n':
+                out.push_back('\n');
+                return true;
+            case 'r':
+                out.push_back('\r');
+                return true;
+            case 't':
+                out.push_back('\t');
+                return true;
+            case 'u':
+                break;
+            default:
+                return false;
+        }
+
+        uint codepoint;
+        if (!read_hex(codepoint)) {
+            return false;
+        }
+
+        if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+            // A surrogate pair
+            uint low;
+            if (end - pos < 2 || pos[0] != '\\' || pos[1] != 'u') {
+                return false;
+            }
+            pos += 2;
+            if (!read_hex(low) || low < 0xDC00 || low > 0xDFFF) {
+                return false;
+            }
+            codepoint =
+                0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+        } else if (codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+            return false;
+        }
+
+        // Encode as UTF-8
+        if (codepoint < 0x80) {
+            out.push_back(codepoint);
+        } else if (codepoint < 0x800) {
+            out.push_back(0xC0 | (codepoint >> 6));
+            out.push_back(0x80 | (codepoint & 0x3F));
+        } else if (codepoint < 0x10000) {
+            out.push_back(0xE0 | (codepoint >> 12));
+            out.push_back(0x80 | ((codepoint >> 6) & 0x3F));
+            out.push_back(0x80 | (codepoint & 0x3F));
+        } else {
+            out.push_back(0xF0 | (codepoint >> 18));
+            out.push_back(0x80 | ((codepoint >> 12) & 0x3F));
+            out.push_back(0x80 | ((codepoint >> 6) & 0x3F));
+            out.push_back(0x80 | (codepoint & 0x3F));
+        }
+        return true;
+    }
+
+   public:
+    JsonReader(std::string_view text)
+        : pos(text.data()), end(text.data() + text.size()) {}
+
+    /**
+     * @brief Look at the next character, after the whitespace
+     * @return char The character, or 0 at the end of the input
+     */
+    char peek() {
+        while (pos != end && is_space(*pos)) {
+            pos++;
+        }
+        return pos != end ? *pos : 0;
+    }
+
+    /**
+     * @brief Consume the next character, if it is the expected one
+     * @param c The character (a bracket, a comma or a colon)
+     */
+    bool consume(const char c) {
+        if (peek() != c) {
+            return false;
+        }
+        pos++;
+        return true;
+    }
+
+    /**
+     * @brief Check if only whitespace is left
+     */
+    bool at_end() { return peek() == 0; }
+
+    /**
+     * @brief Read a string. If it has no escapes, the result points into the
+     * input, otherwise it is decoded into the scratch buffer
+     * @param value The string
+     * @param scratch Storage for the decoded string
+     */
+    bool read_string(std::string_view& value, std::string& scratch) {
+        if (!consume('"')) {
+            return false;
+        }
+
+        const char* start = pos;
+        pos = find_string_special(pos, end);
+        if (pos != end && *pos == '"') {
+            value = std::string_view(start, pos - start);
+            pos++;
+            return true;
+        }
+
+        scratch.assign(start, pos - start);
+        FOREVER {
+            if (pos == end || (uchar)*pos < 0x20) {
+                return false;
+            } else if (*pos == '"') {
+                pos++;
+                value = scratch;
+                return true;
+            }
+
+            // A backslash
+            pos++;
+            if (!read_escape(scratch)) {
+                return false;
+            }
+
+            const char* run = pos;
+            pos = find_string_special(pos, end);
+            scratch.append(run, pos - run);
+        }
+    }
+
+    /**
+     * @brief Read a string into value
+     */
+    bool read_string(std::string& value) {
+        std::string_view view;
+        if (!read_string(view, value)) {
+            return false;
+        }
+        if (view.data() != value.data()) {
+            value.assign(view);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Read a non-negative integer
+     */
+    bool read_uint(lint& value) {
+        peek();
+        const char* start = pos;
+        while (pos != end && *pos >= '0' && *pos <= '9') {
+            pos++;
+        }
+
+        // Fractions, exponents and signs aren't part of this shape
+        if (pos != end && (*pos == '.' || *pos == 'e' || *pos == 'E')) {
+            return false;
+        }
+        return parse_uint_field(std::string_view(start, pos - start), value);
+    }
+
+    /**
+     * @brief Skip the next value, whatever its type
+     */
+    bool skip_value() {
+        char c = peek();
+        if (c == '"') {
+            std::string_view value;
+            std::string scratch;
+            return read_string(value, scratch);
+        }
+
+        if (c != '{' && c != '[') {
+            // A number or a literal
+            const char* start = pos;
+            while (pos != end && !is_space(*pos) && *pos != ',' &&
+                   *pos != '}' && *pos != ']') {
+                pos++;
+            }
+            return pos != start;
+        }
+
+        // An object or an array: only the brackets outside of strings count,
+        // so the reader jumps from one structural byte to the next
+        uint depth = 0;
+        do {
+            pos = find_structural(pos, end);
+            if (pos == end) {
+                return false;
+            }
+
+            c = *pos++;
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                depth--;
+            } else if (c == '"') {
+                pos--;
+                std::string_view value;
+                std::string scratch;
+                if (!read_string(value, scratch)) {
+                    return false;
+                }
+            }
+        } while (depth != 0);
+        return true;
+    }
+};
+
+/**
+ * @brief Read a string field of an object (like {"token": ...} or
+ * {"error": ...}). The other fields are skipped, without being decoded
+ * @param text The JSON object
+ * @param name The name of the field
+ * @param value Where the string is stored
+ * @return true The field was found, and it is a string
+ * @return false The input doesn't have this shape
+ */
+bool read_string_field(std::string_view text, std::string_view name,
+                       std::string& value) {
+    JsonReader reader(text);
+    if (!reader.consume('{') || reader.consume('}')) {
+        return false;
+    }
+
+    std::string_view key;
+    std::string scratch;
+    do {
+        if (!reader.read_string(key, scratch) || !reader.consume(':')) {
+            return false;
+        }
+
+        if (key == name) {
+            return reader.peek() == '"' && reader.read_string(value);
+        } else if (!reader.skip_value()) {
+            return false;
+        }
+    } while (reader.consume(','));
+
+    return false;
+}
+
+/**
+ * @brief Read an unsigned integer field of an object (like the "exp" claim
+ * of a JWT). The other fields are skipped, without being decoded
+ * @param text The JSON object
+ * @param name The name of the field
+ * @param value Where the number is stored
+ * @return true The field was found, and it is an unsigned integer
+ * @return false The input doesn't have this shape
+ */
+bool read_uint_field(std::string_view text, std::string_view name,
+                     lint& value) {
+    JsonReader reader(text);
+    if (!reader.consume('{') || reader.consume('}')) {
+        return false;
+    }
+
+    std::string_view key;
+    std::string scratch;
+    do {
+        if (!reader.read_string(key, scratch) || !reader.consume(':')) {
+            return false;
+        }
+
+        if (key == name) {
+            return reader.read_uint(value);
+        } else if (!reader.skip_value()) {
+            return false;
+        }
+    } while (reader.consume(','));
+
+    return false;
+}
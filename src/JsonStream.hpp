@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "JsonReader.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief Splits a JSON array into its elements while it is being received.
+ * The bytes are fed in chunks (of any size), and every element is passed to
+ * a callback as soon as it is complete, so only one element is held in memory
+ * at a time
+ */
+class JsonArrayStream {
+   public:
+    using ElementHandler = std::function<void(std::string_view)>;
+
+   private:
+    ElementHandler on_element;
+    std::string element;
+    uint depth;
+    bool in_string;
+    bool escaped;
+    bool done;
+    bool invalid;
+
+    static bool is_space(const char c) {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    /**
+     * @brief Pass the current element to the callback (if there is one)
+     */
+    void flush() {
+        while (element.size() != 0 && is_space(element.back())) {
+            element.pop_back();
+        }
+
+        if (element.size() != 0) {
+            on_element(element);
+            element.clear();
+        }
+    }
+
+   public:
+    JsonArrayStream(const ElementHandler& on_element)
+        : on_element(on_element),
+          depth(0),
+          in_string(false),
+          escaped(false),
+          done(false),
+          invalid(false) {}
+
+    /**
+     * @brief Process the next chunk of the array
+     * @param data The chunk
+     * @param size The size of the chunk
+     */
+    void feed(const char* data, const size_t size) {
+        const char* pos = data;
+        const char* end = data + size;
+
+        while (pos != end && !done && !invalid) {
+            if (depth == 0) {
+                // Waiting for the array to start
+                if (*pos == '[') {
+                    depth = 1;
+                } else if (!is_space(*pos)) {
+                    invalid = true;
+                }
+                pos++;
+                continue;
+            }
+
+            if (in_string) {
+                if (escaped) {
+                    escaped = false;
+                    element.push_back(*pos++);
+                    continue;
+                }
+
+                // Copy the plain part of the string at once
+                const char* special = find_string_special(pos, end);
+                element.append(pos, special - pos);
+                pos = special;
+                if (pos == end) {
+                    break;
+                }
+
+                const char c = *pos++;
+                element.push_back(c);
+                if (c == '\\') {
+                    escaped = true;
+                } else if (c == '"') {
+                    in_string = false;
+                }
+                continue;
+            }
+
+            if (depth == 1 && element.size() == 0 && is_space(*pos)) {
+                pos++;
+                continue;
+            }
+
+            // Copy everything up to the next bracket, quote or comma
+            const char* structural = find_structural(pos, end);
+            element.append(pos, structural - pos);
+            pos = structural;
+            if (pos == end) {
+                break;
+            }
+
+            const char c = *pos++;
+            if (depth == 1 && (c == ']' || c == ',')) {
+                // The end of an element (or of the array)
+                flush();
+                if (c == ']') {
+                    depth = 0;
+                    done = true;
+                }
+                continue;
+            }
+
+            element.push_back(c);
+            if (c == '"') {
+                in_string = true;
+            } else if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                depth--;
+                if (depth == 1) {
+                    flush();
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Check if the whole array was received, and it was well formed
+     */
+    bool is_complete() const { return done && !invalid; }
+};
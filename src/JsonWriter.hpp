@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Utils.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_WRITER_SSE2 1
+#endif
+
+/**
+ * @brief Find the first byte of a string that can't be copied as it is in a
+ * JSON string: control characters, quotes, backslashes and non-ASCII bytes
+ * @param data The string
+ * @param begin Where the search starts
+ * @param size The size of the string
+ * @return size_t The position of the byte (or size, if there is none)
+ */
+size_t find_json_special(const char* data, size_t begin, const size_t size) {
+    size_t i = begin;
+#ifdef JSON_WRITER_SSE2
+    // Compared as signed bytes, both the control characters and the
+    // non-ASCII bytes are lower than 0x20
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i special = _mm_or_si128(
+            _mm_cmplt_epi8(v, space),
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                         _mm_cmpeq_epi8(v, backslash)));
+        uint mask = _mm_movemask_epi8(special);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < size; i++) {
+        uchar c = data[i];
+        if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\') {
+            return i;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Append a string to a JSON document, quoted and escaped exactly like
+ * json::dump() does it
+ * @param out The document
+ * @param value The string
+ */
+void append_json_string(std::string& out, std::string_view value) {
+    const size_t start = out.size();
+    out.push_back('"');
+
+    size_t i = 0;
+    while (i < value.size()) {
+        size_t special = find_json_special(value.data(), i, value.size());
+        out.append(value.data() + i, special - i);
+        if (special == value.size()) {
+            break;
+        }
+
+        uchar c = value[special];
+        if (c >= 0x80) {
+            // UTF-8 must be validated (and rejected the same way), so this
+            // string is left to the json library
+            out.resize(start);
+            out.append(json(std::string(value)).dump());
+            return;
+        }
+
+        out.push_back('\\');
+        switch (c) {
+            case '\b':
+                out.push_back('b');
+                break;
+            case '\t':
+                out.push_back('t');
+                break;
+            case '\n':
+                out.push_back('n');
+                break;
+            case '\f':
+                out.push_back('f');
+                break;
+            case '\r':
+                out.push_back('r');
+                break;
+            case '"':
+                out.push_back('"');
+                break;
+            case '\\':
+                out.push_back('\\');
+                break;
+            default: {
+                const char* hex = "0123456789abcdef";
+                out.append("u00");
+                out.push_back(hex[c >> 4]);
+                out.push_back(hex[c & 0xF]);
+            }
+        }
+        i = special + 1;
+    }
+
+    out.push_back('"');
+}
+
+/**
+ * @brief Quote and escape a string, the way it is shown by json::dump()
+ * @param value The string
+ * @return std::string The JSON string
+ */
+std::string json_quoted(std::string_view value) {
+    std::string out;
+    append_json_string(out, value);
+    return out;
+}
+
+/**
+ * @brief Writes a JSON object directly into a buffer, without building a
+ * DOM. The output is compact, like the one of json::dump(); the keys are
+ * written in the order they are given
+ */
+class JsonWriter {
+   private:
+    std::string& out;
+    bool first;
+
+   public:
+    JsonWriter(std::string& out) : out(out), first(true) {}
+
+    void begin_object() {
+        out.push_back('{');
+        first = true;
+    }
+
+    void end_object() { out.push_back('}'); }
+
+    void key(std::string_view name) {
+        if (!first) {
+            out.push_back(',');
+        }
+        first = false;
+        append_json_string(out, name);
+        out.push_back(':');
+    }
+
+    void value(std::string_view val) { append_json_string(out, val); }
+
+    void value(const lint val) { out.append(std::to_string(val)); }
+};
@@ -0,0 +1,248 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Book.hpp"
+#include "BookTable.hpp"
+#include "Snapshot.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief The local copy of the user's library. It is filled by the reads
+ * (get_books, get_book) and updated by the successful writes, so the reads
+ * that follow them can be answered without another request. The copy is
+ * only trusted for LIBRARY_TTL seconds after it was last synchronized with
+ * the server. Until the first synchronization or write, a snapshot saved by
+ * a previous run can be used instead
+ */
+class LocalLibrary {
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    BookTable listing;
+    bool has_listing;
+    Clock::time_point listing_synced;
+
+    std::unordered_map<lint, Book> details;
+    std::unordered_map<lint, Clock::time_point> details_synced;
+
+    // Saved by a previous run, and dropped once the library is synchronized
+    // or modified (it doesn't know about the changes)
+    std::unique_ptr<Snapshot> snapshot;
+
+    // Changes every time the local copy is modified or dropped, so a read
+    // that started before that doesn't overwrite it with older data
+    lint epoch;
+
+    // Changes every time the content of the local copy changes, so an
+    // unchanged library isn't written again
+    lint revision;
+    lint saved_revision;
+    std::string saved_owner;
+
+    // Only what a snapshot keeps of the listing (the ids and the titles) is
+    // compared
+    static bool same_listing(const BookTable& a, const BookTable& b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t row = 0; row < a.size(); row++) {
+            if (a.id(row) != b.id(row) || a.title(row) != b.title(row)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool same_book(const Book& a, const Book& b) {
+#define BOOK_SAME_FIELD(type, name, sent) a.name == b.name&&
+        return BOOK_FIELDS(BOOK_SAME_FIELD) true;
+#undef BOOK_SAME_FIELD
+    }
+
+    static bool is_fresh(const Clock::time_point synced) {
+        return LIBRARY_TTL != 0 &&
+               Clock::now() < synced + std::chrono::seconds(LIBRARY_TTL);
+    }
+
+   public:
+    LocalLibrary()
+        : has_listing(false), epoch(0), revision(0), saved_revision(-1) {}
+
+    /**
+     * @brief The current epoch, to be passed back when the result of a read
+     * is stored
+     */
+    lint get_epoch() const { return epoch; }
+
+    /**
+     * @brief Get the listing, if it can be used without asking the server
+     * @return const BookTable* The listing, or nullptr
+     */
+    const BookTable* get_listing() const {
+        return has_listing && is_fresh(listing_synced) ? &listing : nullptr;
+    }
+
+    /**
+     * @brief Get the details of a book, if they can be used without asking
+     * the server
+     * @return const Book* The book, or nullptr
+     */
+    const Book* get_book(const lint id) const {
+        auto it = details.find(id);
+        if (it == details.end() || !is_fresh(details_synced.at(id))) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    /**
+     * @brief Use a snapshot until the library is synchronized
+     */
+    void attach_snapshot(std::unique_ptr<Snapshot> saved) {
+        snapshot = std::move(saved);
+    }
+
+    /**
+     * @brief Get the snapshot of a user's library, if the library wasn't
+     * synchronized yet
+     * @param owner The user
+     * @return const Snapshot* The snapshot, or nullptr
+     */
+    const Snapshot* get_snapshot(const std::string& owner) const {
+        if (!snapshot || owner == "" || snapshot->owner() != owner) {
+            return nullptr;
+        }
+        return snapshot.get();
+    }
+
+    /**
+     * @brief Save the library (the last listing, and the known details),
+     * unless it didn't change since it was last saved
+     * @param path The snapshot file
+     * @param owner The user the library belongs to
+     * @return true The snapshot is up to date
+     */
+    bool save_snapshot(const std::string& path, const std::string& owner) {
+        if (!has_listing || owner == "") {
+            return false;
+        }
+        if (revision == saved_revision && owner == saved_owner) {
+            return true;
+        }
+        if (!write_snapshot(path, owner, listing, details)) {
+            return false;
+        }
+        saved_revision = revision;
+        saved_owner = owner;
+        return true;
+    }
+
+    /**
+     * @brief Store the listing received from the server
+     * @param books The listing
+     * @param read_epoch The epoch when the read started
+     */
+    void store_listing(BookTable books, const lint read_epoch) {
+        if (read_epoch != epoch) {
+            return;
+        }
+        if (!has_listing || !same_listing(listing, books)) {
+            revision++;
+        }
+        listing = std::move(books);
+        has_listing = true;
+        listing_synced = Clock::now();
+        snapshot.reset();
+    }
+
+    /**
+     * @brief Store the details of a book received from the server
+     * @param book The book
+     * @param read_epoch The epoch when the read started
+     */
+    void store_book(const Book& book, const lint read_epoch) {
+        if (read_epoch != epoch) {
+            return;
+        }
+        auto it = details.find(book.id);
+        if (it == details.end() || !same_book(it->second, book)) {
+            revision++;
+        }
+        details[book.id] = book;
+        details_synced[book.id] = Clock::now();
+    }
+
+    /**
+     * @brief A book was added. Without its id (if the server didn't return
+     * it), the listing can't be updated, so it is dropped
+     * @param book The book
+     * @param has_id If the id of the book is known
+     */
+    void added(const Book& book, const bool has_id) {
+        epoch++;
+        revision++;
+        snapshot.reset();
+        if (!has_id) {
+            has_listing = false;
+            return;
+        }
+
+        if (has_listing) {
+            listing.append(book);
+        }
+        details[book.id] = book;
+        details_synced[book.id] = Clock::now();
+    }
+
+    /**
+     * @brief A book was removed
+     * @param id The id of the book
+     */
+    void removed(const lint id) {
+        epoch++;
+        revision++;
+        snapshot.reset();
+        if (has_listing) {
+            size_t row = listing.find(id);
+            if (row != listing.size()) {
+                listing.erase(row);
+            }
+        }
+        details.erase(id);
+        details_synced.erase(id);
+    }
+
+    /**
+     * @brief Drop everything (the user logged out, or entered the library
+     * again). The snapshot is kept, since it is only ever shown to its owner
+     */
+    void clear() {
+        epoch++;
+        revision++;
+        listing.clear();
+        has_listing = false;
+        details.clear();
+        details_synced.clear();
+    }
+};
@@ -0,0 +1,444 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "Cache.hpp"
+#include "ConnectionPool.hpp"
+#include "Request.hpp"
+#include "SingleFlight.hpp"
+#include "ThreadPool.hpp"
+#include "Utils.hpp"
+
+// Only the requests of the library API are forwarded
+#define PROXY_PREFIX "/api/v1/tema/"
+
+// The biggest request header accepted from a client, in bytes
+#define PROXY_MAX_HEADER (64 << 10)
+
+// How many clients are served at the same time (the others are refused)
+#define PROXY_MAX_CLIENTS 64
+
+/**
+ * @brief A HTTP/1.1 request received by the proxy
+ */
+struct ProxyRequest {
+    std::string method;
+    std::string target;
+    std::vector<KeyValue> headers;
+    std::string body;
+
+    /**
+     * @brief Get the value of a header field
+     * @param name The name of the field (case insensitive)
+     * @return std::string The value ("" if the field is missing)
+     */
+    std::string get_header(std::string_view name) const {
+        std::string lower = to_lower(name);
+        for (auto& field : headers) {
+            if (to_lower(field.key) == lower) {
+                return field.value;
+            }
+        }
+        return "";
+    }
+};
+
+/**
+ * @brief Build a response of the proxy itself, with a JSON error like the
+ * ones of the server
+ * @param code The status code
+ * @param reason The reason phrase
+ * @param error The error message
+ */
+std::string proxy_error(const uint code, const std::string& reason,
+                        const std::string& error) {
+    std::string body = json{{"error", error}}.dump();
+    std::stringstream ss;
+    ss << "HTTP/1.1 " << code << " " << reason << ENDL;
+    ss << "Content-Type: application/json; charset=utf-8" << ENDL;
+    ss << "Content-Length: " << body.size() << ENDL;
+    ss << ENDL;
+    ss << body;
+    return ss.str();
+}
+
+/**
+ * @brief A local HTTP server that forwards the requests of the library API to
+ * the server, over the persistent connections of a pool, so many programs on
+ * the same host share them. The cacheable GET responses are served from a
+ * shared cache (revalidated with the server once they are stale), and
+ * identical GET requests in flight at the same time are sent only once
+ */
+class ReverseProxy {
+   public:
+    // A whole response, as it is sent to the clients
+    using Reply = std::shared_ptr<const std::string>;
+
+   private:
+    Endpoint& endpoint;
+    ConnectionPool& pool;
+    ResponseCache& cache;
+    SingleFlight<Reply> flights;
+
+    // Every client is served by a worker, while it keeps its connection
+    ThreadPool clients;
+    std::atomic<size_t> active;
+
+    /**
+     * @brief Read a request from a client. The bytes after it (the next
+     * request, if the client sends many at once) are kept in the buffer
+     * @param fd The connection of the client
+     * @param buffer The bytes received, but not used yet
+     * @param request Where the request is stored
+     * @param error Set to the response to send, if the request is malformed
+     * @return true A request was read (or it is malformed)
+     * @return false The client closed the connection, or it timed out
+     */
+    static bool read_request(const int fd, std::string& buffer,
+                             ProxyRequest& request, std::string& error) {
+        char chunk[BUFLEN];
+        size_t header_end;
+        while ((header_end = buffer.find(HEADER_TERMINATOR)) ==
+               std::string::npos) {
+            if (buffer.size() > PROXY_MAX_HEADER) {
+                error = proxy_error(431, "Request Header Fields Too Large",
+                                    "The header is too large");
+                return true;
+            }
+            ssize_t bytes = read(fd, chunk, sizeof(chunk));
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                return false;
+            }
+            buffer.append(chunk, bytes);
+        }
+
+        request = ProxyRequest();
+        std::string_view header(buffer.data(), header_end);
+        std::size_t line_end = header.find(ENDL);
+        std::string_view line = header.substr(0, line_end);
+
+        // The request line: the method, the target, and the version
+        std::size_t first = line.find(' ');
+        std::size_t last = line.rfind(' ');
+        if (first == std::string_view::npos || first == last ||
+            line.substr(last + 1).compare(0, 5, "HTTP/") != 0) {
+            error = proxy_error(400, "Bad Request", "Invalid request line");
+            return true;
+        }
+        request.method = std::string(line.substr(0, first));
+        request.target = std::string(line.substr(first + 1, last - first - 1));
+
+        while (line_end != std::string_view::npos) {
+            header.remove_prefix(line_end + 2);
+            line_end = header.find(ENDL);
+            line = header.substr(0, line_end);
+
+            std::size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                error = proxy_error(400, "Bad Request", "Invalid header field");
+                return true;
+            }
+            request.headers.push_back(
+                KeyValue(std::string(trim_spaces(line.substr(0, colon))),
+                         std::string(trim_spaces(line.substr(colon + 1)))));
+        }
+
+        // Only the bodies with a length are supported, like in the responses
+        size_t length = 0;
+        std::string field = request.get_header("Content-Length");
+        if (request.get_header("Transfer-Encoding") != "") {
+            error = proxy_error(501, "Not Implemented",
+                                "Transfer-Encoding isn't supported");
+            return true;
+        }
+        if (field != "" && !parse_uint_field(field, length)) {
+            error = proxy_error(400, "Bad Request", "Invalid Content-Length");
+            return true;
+        }
+
+        size_t body_start = header_end + sizeof(HEADER_TERMINATOR) - 1;
+        while (buffer.size() < body_start + length) {
+            ssize_t bytes = read(fd, chunk, sizeof(chunk));
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                return false;
+            }
+            buffer.append(chunk, bytes);
+        }
+        request.body = buffer.substr(body_start, length);
+        buffer.erase(0, body_start + length);
+        return true;
+    }
+
+    /**
+     * @brief Build the request sent to the server: the one of the client,
+     * with the host of the server, and without the fields that only describe
+     * the connection of the client
+     * @param request The request of the client
+     * @param extra Other header fields (like the cache validators)
+     */
+    std::string upstream_request(const ProxyRequest& request,
+                                 const std::vector<KeyValue>& extra) const {
+        std::stringstream ss;
+        ss << request.method << " " << request.target << " HTTP/1.1" << ENDL;
+        ss << "Host: " << endpoint.get_host() << ENDL;
+        for (auto& field : request.headers) {
+            std::string name = to_lower(field.key);
+            if (name != "host" && name != "connection" &&
+                name != "keep-alive" && name != "proxy-connection") {
+                ss << field.key << ": " << field.value << ENDL;
+            }
+        }
+        for (auto& field : extra) {
+            ss << field.key << ": " << field.value << ENDL;
+        }
+        ss << ENDL;
+        ss << request.body;
+        return ss.str();
+    }
+
+    /**
+     * @brief Send a request to the server
+     * @param request The request
+     * @param r Where the response is stored
+     * @return Reply The response, as it is sent to the client
+     */
+    Reply forward(const std::string& request, Response& r) {
+        r = pool.execute(request);
+        if (r.get_response_code() == 0) {
+            return std::make_shared<const std::string>(proxy_error(
+                502, "Bad Gateway", "The server can't be reached"));
+        }
+        return std::make_shared<const std::string>(r.get_raw_header() +
+                                                   std::string(r.body_view()));
+    }
+
+    /**
+     * @brief Execute a GET request through the cache. Fresh entries are used
+     * without contacting the server, and stale ones are revalidated (or used
+     * as they are, while the server can't be reached)
+     * @param request The request of the client
+     * @param key The key of the request in the cache
+     * @return Reply The response
+     */
+    Reply cached_get(const ProxyRequest& request, const std::string& key) {
+        bool fresh = false;
+        ResponseCache::Entry entry = cache.lookup(key, fresh);
+        auto replay = [&]() {
+            return std::make_shared<const std::string>(entry->header +
+                                                       entry->body);
+        };
+        if (entry && fresh) {
+            return replay();
+        }
+
+        std::vector<KeyValue> validators;
+        if (entry && entry->etag.size() != 0) {
+            validators.push_back(KeyValue("If-None-Match", entry->etag));
+        }
+        if (entry && entry->last_modified.size() != 0) {
+            validators.push_back(
+                KeyValue("If-Modified-Since", entry->last_modified));
+        }
+
+        Response r("");
+        Reply reply = forward(upstream_request(request, validators), r);
+        if (r.get_response_code() == 0 && entry) {
+            return replay();
+        }
+        if (r.get_response_code() == 304 && entry) {
+            cache.renew(key, get_cache_policy(r).max_age);
+            return replay();
+        }
+
+        CachePolicy policy = get_cache_policy(r);
+        if (is_code_success(r.get_response_code()) && policy.store) {
+            CacheEntry received;
+            received.header = cached_header(r);
+            received.body = std::string(r.body_view());
+            received.etag = r.get_header("ETag");
+            received.last_modified = r.get_header("Last-Modified");
+            cache.store(key, std::move(received), policy.max_age);
+        } else if (entry) {
+            cache.invalidate(key);
+        }
+        return reply;
+    }
+
+    /**
+     * @brief Answer a request of a client
+     * @param request The request
+     * @return Reply The response
+     */
+    Reply handle(const ProxyRequest& request) {
+        if (request.target.compare(0, sizeof(PROXY_PREFIX) - 1,
+                                   PROXY_PREFIX) != 0) {
+            return std::make_shared<const std::string>(
+                proxy_error(404, "Not Found", "Only " PROXY_PREFIX
+                                              " is forwarded"));
+        }
+
+        // The responses depend on the credentials of the client
+        std::string identity = request.get_header("Authorization") + " " +
+                               request.get_header("Cookie");
+        std::string key =
+            ResponseCache::key(request.method, request.target, identity);
+
+        // The conditional requests of the clients are left to the server
+        if (request.method == "GET" &&
+            request.get_header("If-None-Match") == "" &&
+            request.get_header("If-Modified-Since") == "") {
+            return flights.run(key,
+                               [&]() { return cached_get(request, key); });
+        }
+
+        Response r("");
+        Reply reply = forward(upstream_request(request, {}), r);
+
+        // A modified resource, and the collection that contains it, are
+        // fetched again
+        if (request.method != "GET" && is_code_success(r.get_response_code())) {
+            std::string url = request.target;
+            cache.invalidate(ResponseCache::key("GET", url, identity));
+            cache.invalidate(ResponseCache::key(
+                "GET", url.substr(0, url.find_last_of('/')), identity));
+        }
+        return reply;
+    }
+
+    /**
+     * @brief Check that the end of a response is known from its header (a
+     * response whose body ends when the connection is closed ends the
+     * connection of the client too)
+     */
+    static bool ends_message(const std::string& reply) {
+        Response r(reply.substr(0, reply.find(HEADER_TERMINATOR) +
+                                       sizeof(HEADER_TERMINATOR) - 1));
+        uint code = r.get_response_code();
+        return to_lower(r.get_header("Connection")) != "close" &&
+               (r.get_header("Content-Length") != "" || code == 204 ||
+                code == 304 || code < 200);
+    }
+
+    /**
+     * @brief Answer the requests of a client, until it closes its connection
+     * @param fd The connection
+     */
+    void serve_client(const int fd) {
+        // An idle client doesn't keep its thread forever
+        timeval timeout = {PROXY_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::string buffer;
+        ProxyRequest request;
+        std::string error;
+        while (read_request(fd, buffer, request, error)) {
+            if (error != "") {
+                send_all(fd, error.data(), error.size());
+                break;
+            }
+
+            Reply reply = handle(request);
+            if (!send_all(fd, reply->data(), reply->size()) ||
+                to_lower(request.get_header("Connection")) == "close" ||
+                !ends_message(*reply)) {
+                break;
+            }
+        }
+        close(fd);
+    }
+
+   public:
+    /**
+     * @brief Create a proxy
+     * @param endpoint The address of the server
+     * @param pool The connections to the server
+     * @param cache The cache of the GET responses
+     */
+    ReverseProxy(Endpoint& endpoint, ConnectionPool& pool,
+                 ResponseCache& cache)
+        : endpoint(endpoint),
+          pool(pool),
+          cache(cache),
+          clients(PROXY_MAX_CLIENTS),
+          active(0) {}
+
+    ReverseProxy(const ReverseProxy&) = delete;
+    ReverseProxy& operator=(const ReverseProxy&) = delete;
+
+    /**
+     * @brief Listen on the loopback interface, and answer every client on
+     * a worker of its own (the program has to be stopped by a signal). While
+     * PROXY_MAX_CLIENTS are served, the new ones are refused with a 503
+     * @param port The port
+     */
+    void serve(const int port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        MUST(fd >= 0, "Couldn't create socket\n");
+        int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+        sockaddr_in address;
+        bzero(&address, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        MUST(bind(fd, (sockaddr*)&address, sizeof(address)) == 0,
+             "Couldn't bind port " << port << "\n");
+        MUST(listen(fd, SOMAXCONN) == 0, "Couldn't listen on " << port << "\n");
+        std::cout << "Forwarding 127.0.0.1:" << port << PROXY_PREFIX << " to "
+                  << endpoint.get_host() << ":" << endpoint.get_port() << "\n";
+        std::cout.flush();
+
+        FOREVER {
+            int client = accept(fd, nullptr, nullptr);
+            if (client < 0) {
+                CERR(errno != EINTR && errno != ECONNABORTED);
+                continue;
+            }
+            int nodelay = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+                       sizeof(nodelay));
+
+            if (active >= PROXY_MAX_CLIENTS) {
+                std::string busy = proxy_error(503, "Service Unavailable",
+                                               "Too many clients");
+                send_all(client, busy.data(), busy.size());
+                close(client);
+                continue;
+            }
+            active++;
+            clients.submit([this, client] {
+                serve_client(client);
+                active--;
+            });
+        }
+    }
+};
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include "JsonWriter.hpp"
 #include "Utils.hpp"
 
 class KeyValue {
@@ -33,43 +34,60 @@ class KeyValue {
         : key(key), value(value) {}
 };
 
-class Cookie {
-   private:
-    std::string key;
-    std::string value;
-
-   public:
-    Cookie() : key(""), value(""){};
-    Cookie(const std::string& key, const std::string& value)
-        : key(key), value(value) {}
-
-    bool is_null() const { return key == "" && value == ""; }
-
-    void set_key(const std::string& _key) { key = _key; }
-
-    void set_value(const std::string& _value) { value = _value; }
+/**
+ * @brief Write a list of key-value pairs as a JSON object of strings. The
+ * result is identical to filling a json object and calling dump(): the keys
+ * are sorted, if a key is repeated its last value is kept, and no pairs at all
+ * give "null"
+ * @param out The buffer where the object is appended
+ * @param body_data The pairs
+ */
+void write_json_object(std::string& out,
+                       const std::vector<KeyValue>& body_data) {
+    if (body_data.size() == 0) {
+        out.append("null");
+        return;
+    }
 
-    friend std::ostream& operator<<(std::ostream& out, const Cookie& cookie) {
-        out << cookie.key << "=" << cookie.value;
-        return out;
+    std::vector<const KeyValue*> pairs;
+    pairs.reserve(body_data.size());
+    for (auto& kv : body_data) {
+        pairs.push_back(&kv);
     }
-};
+    std::stable_sort(pairs.begin(), pairs.end(),
+                     [](const KeyValue* a, const KeyValue* b) {
+                         return a->key < b->key;
+                     });
+
+    JsonWriter writer(out);
+    writer.begin_object();
+    for (size_t i = 0; i < pairs.size(); i++) {
+        if (i + 1 < pairs.size() && pairs[i + 1]->key == pairs[i]->key) {
+            continue;
+        }
+        writer.key(pairs[i]->key);
+        writer.value(pairs[i]->value);
+    }
+    writer.end_object();
+}
 
 /**
  * @brief Create a HTTP/1.1 GET request
  * @param host The hostname
  * @param url The url
  * @param query_params The query parameters (can be "" if not needed)
- * @param cookies A list of cookies (the can be "not specified")
+ * @param cookies The value of the Cookie field, rendered by a cookie jar (can
+ * be "" if not needed)
  * @param jwt_token The jwt used in the connection (this isn't generically
  * implemented)
+ * @param headers Other header fields (like the cache validators)
  * @return std::string The request
  */
 std::string create_get_request(
     const std::string& host, const std::string& url,
-    const std::string& query_params = "",
-    std::vector<Cookie> cookies = std::vector<Cookie>(),
-    const std::string& jwt_token = "") {
+    const std::string& query_params = "", const std::string& cookies = "",
+    const std::string& jwt_token = "",
+    const std::vector<KeyValue>& headers = std::vector<KeyValue>()) {
     // Start building the request
     std::stringstream ss;
     if (query_params.size() != 0) {
@@ -82,17 +100,12 @@ std::string create_get_request(
     if (jwt_token != "") {
         ss << "Authorization: Bearer " << jwt_token << ENDL;
     }
+    for (auto& field : headers) {
+        ss << field.key << ": " << field.value << ENDL;
+    }
 
     if (cookies.size() != 0) {
-        ss << "Cookie: ";
-        uint i = 1;
-        for (auto& cookie : cookies) {
-            ss << cookie;
-            if (i++ != cookies.size()) {
-                ss << "; ";
-            }
-        }
-        ss << ENDL;
+        ss << "Cookie: " << cookies << ENDL;
     }
     ss << ENDL;
     return ss.str();
@@ -102,15 +115,15 @@ std::string create_get_request(
  * @brief Create a HTTP/1.1 DELETE request
  * @param host The hostname
  * @param url The url
- * @param cookies A list of cookies (the can be "not specified")
+ * @param cookies The value of the Cookie field, rendered by a cookie jar (can
+ * be "" if not needed)
  * @param jwt_token The jwt used in the connection (this isn't generically
  * implemented)
  * @return std::string The request
  */
 std::string create_delete_request(
     const std::string& host, const std::string& url,
-    std::vector<Cookie> cookies = std::vector<Cookie>(),
-    const std::string& jwt_token = "") {
+    const std::string& cookies = "", const std::string& jwt_token = "") {
     // Start building the request
     std::stringstream ss;
 
@@ -122,36 +135,28 @@ std::string create_delete_request(
     }
 
     if (cookies.size() != 0) {
-        ss << "Cookie: ";
-        uint i = 1;
-        for (auto& cookie : cookies) {
-            ss << cookie;
-            if (i++ != cookies.size()) {
-                ss << "; ";
-            }
-        }
-        ss << ENDL;
+        ss << "Cookie: " << cookies << ENDL;
     }
     ss << ENDL;
     return ss.str();
 }
 
 /**
- * @brief Create a HTTP/1.1 POST request
+ * @brief Create a HTTP/1.1 POST request, with a body that is already encoded
  * @param host The hostname
  * @param url The url
  * @param content_type The type of the data
- * @param body_data The data (json or x-www-form-urlenconded)
- * @param cookies A list of cookies (the can be "not specified")
+ * @param body The encoded data
+ * @param cookies The value of the Cookie field, rendered by a cookie jar (can
+ * be "" if not needed)
  * @param jwt_token The jwt used in the connection (this isn't generically
  * implemented)
  * @return std::string The request
  */
 std::string create_post_request(
     const std::string& host, const std::string& url,
-    const std::string& content_type, std::vector<KeyValue> body_data,
-    std::vector<Cookie> cookies = std::vector<Cookie>(),
-    const std::string& jwt_token = "") {
+    const std::string& content_type, const std::string& body,
+    const std::string& cookies = "", const std::string& jwt_token = "") {
     // Start building the request
     std::stringstream ss;
 
@@ -161,43 +166,68 @@ std::string create_post_request(
         ss << "Authorization: Bearer " << jwt_token << ENDL;
     }
     ss << "Content-Type: " << content_type << ENDL;
+    ss << "Content-Length: " << body.size() << ENDL;
+    if (cookies.size() != 0) {
+        ss << "Cookie: " << cookies << ENDL;
+    }
+
+    // Nothing follows the body: on a persistent connection, the bytes after
+    // it would be read as the start of the next request
+    ss << ENDL;
+    ss << body;
+    return ss.str();
+}
 
-    std::stringstream body;
+/**
+ * @brief Create a HTTP/1.1 POST request
+ * @param host The hostname
+ * @param url The url
+ * @param content_type The type of the data
+ * @param body_data The data (json or x-www-form-urlenconded)
+ * @param cookies The value of the Cookie field, rendered by a cookie jar (can
+ * be "" if not needed)
+ * @param jwt_token The jwt used in the connection (this isn't generically
+ * implemented)
+ * @return std::string The request
+ */
+std::string create_post_request(
+    const std::string& host, const std::string& url,
+    const std::string& content_type, const std::vector<KeyValue>& body_data,
+    const std::string& cookies = "", const std::string& jwt_token = "") {
+    std::string body;
     if (content_type == "application/json") {
-        json data;
-        for (auto& kv : body_data) {
-            data[kv.key] = kv.value;
-        }
-        body << data.dump();
+        write_json_object(body, body_data);
     } else {
         // We suppose it is application/x-www-form-urlenconded, as these two are
         // the only two data types supported
         uint i = 1;
         for (auto& kv : body_data) {
-            body << kv.key << "=" << kv.value;
+            body.append(kv.key).append("=").append(kv.value);
             if (i++ != body_data.size()) {
-                body << "&";
+                body.append("&");
             }
         }
     }
-    ss << "Content-Length: " << body.str().size() << ENDL;
-    if (cookies.size() != 0) {
-        ss << "Cookie: ";
-        uint i = 1;
-        for (auto& cookie : cookies) {
-            ss << cookie;
-            if (i++ != cookies.size()) {
-                ss << "; ";
-            }
-        }
-        ss << ENDL;
-    }
 
-    ss << ENDL;
-    ss << body.str();
-    ss << ENDL;
-    return ss.str();
+    return create_post_request(host, url, content_type, body, cookies,
+                               jwt_token);
 }
 
 // POST
-// DELETE
\ No newline at end of file
+// DELETE
+/**
+ * @brief Get the method of a request (the first word of its request line)
+ */
+std::string_view request_method(std::string_view request) {
+    return request.substr(0, request.find(' '));
+}
+
+/**
+ * @brief Check if a request can be sent again, without knowing if the server
+ * received it the first time: only the ones that don't change anything (a
+ * POST or a DELETE would be applied twice)
+ */
+bool can_resend(std::string_view request) {
+    std::string_view method = request_method(request);
+    return method == "GET" || method == "HEAD";
+}
@@ -22,7 +22,9 @@
 
 #pragma once
 
-#include "Request.hpp"
+#include "CookieJar.hpp"
+#include "JsonReader.hpp"
+#include "Scanner.hpp"
 #include "Utils.hpp"
 
 /**
@@ -31,84 +33,182 @@
 class Response {
    private:
     uint code;
-    Cookie session_id;
-    json data_j;
+    std::size_t content_length;
     std::string jwt_token;
 
+    // The header, and the positions of the CRLF pairs that end its lines
+    std::string header;
+    std::vector<std::size_t> lines;
+
+    // The body is kept as it was received, and only parsed when needed
+    std::string data;
+    bool has_json;
+    bool parsed;
+    json data_j;
+
    public:
     Response(const std::string& response) {
-        std::vector<std::string> tokens;
-        std::string data;
-
-        std::size_t curr, prev = 0;
-        curr = response.find(ENDL);
-        while (curr != std::string::npos) {
-            tokens.push_back(response.substr(prev, curr - prev));
-            prev = curr + 1;
-            curr = response.find(ENDL, prev);
+        std::vector<std::string_view> tokens;
+
+        // Split the header into lines, in a single pass
+        std::size_t header_end =
+            index_header(response.data(), response.size(), lines);
+        std::size_t prev = 0;
+        for (auto& curr : lines) {
+            tokens.push_back(
+                std::string_view(response.data() + prev, curr - prev));
+            prev = curr + 2;
         }
 
         // Extract first line of the header (version, code...)
-        std::istringstream iss(tokens[0]);
-        std::vector<std::string> status(
-            (std::istream_iterator<std::string>(iss)),
-            std::istream_iterator<std::string>());
-
-        code = std::stoi(status[1]);
-        tokens.erase(tokens.begin());
+        code = 0;
+        if (tokens.size() != 0) {
+            std::string_view status = tokens[0];
+            std::size_t code_start = status.find(' ');
+            if (code_start != std::string_view::npos) {
+                status = status.substr(code_start + 1);
+                status = status.substr(0, status.find(' '));
+                if (!parse_uint_field(status, code)) {
+                    code = 0;
+                }
+            }
+            tokens.erase(tokens.begin());
+        }
 
         // Extract data
-        curr = response.find(HEADER_TERMINATOR);
-        data = response.substr(curr + sizeof(HEADER_TERMINATOR) - 1);
+        if (header_end != std::string::npos) {
+            header = response.substr(0, header_end);
+            data = response.substr(header_end);
+        } else {
+            header = response;
+        }
 
-        bool hasData = false;
-        bool isJson = false;
+        // The fields are matched without regard to case
+        if (!parse_uint_field(get_header("Content-Length"), content_length)) {
+            content_length = 0;
+        }
+        bool hasData = content_length != 0;
 
-        for (auto& token : tokens) {
-            std::size_t pos;
-            std::string val;
+        std::string_view type = get_header("Content-Type");
+        bool isJson = type.substr(0, type.find(';')) == "application/json";
 
-            if ((pos = token.find("connect.sid=")) != std::string::npos) {
-                val = token.substr(pos + sizeof("connect.sid=") - 1);
-                val = val.substr(0, val.find(';'));
+        // The body only counts if the content-length is set
+        if (!hasData) {
+            data.clear();
+        }
+        has_json = isJson;
+        parsed = false;
+    }
 
-                session_id.set_key("connect.sid");
-                session_id.set_value(val);
-            } else if ((pos = token.find("Content-Length: ")) !=
-                       std::string::npos) {
-                val = token.substr(pos + sizeof("Content-Length: ") - 1);
+    uint get_response_code() const { return code; }
 
-                if (val != "0") {
-                    hasData = true;
-                }
-            } else if ((pos = token.find("Content-Type: ")) !=
-                       std::string::npos) {
-                std::string val =
-                    token.substr(pos + sizeof("Content-Type: ") - 1);
-                val = val.substr(0, val.find(';'));
-
-                if (val == "application/json") {
-                    isJson = true;
-                }
+    std::size_t get_content_length() const { return content_length; }
+
+    /**
+     * @brief Get the values of a header field that can be repeated (like
+     * Set-Cookie)
+     * @param name The name of the field (case insensitive)
+     * @return std::vector<std::string_view> The values, without the
+     * surrounding spaces, in the order they were received
+     */
+    std::vector<std::string_view> get_headers(std::string_view name) const {
+        std::vector<std::string_view> values;
+        for (std::size_t i = 0; i + 1 < lines.size(); i++) {
+            std::string_view line(header.data() + lines[i] + 2,
+                                  lines[i + 1] - lines[i] - 2);
+            if (line.size() <= name.size() || line[name.size()] != ':' ||
+                !std::equal(name.begin(), name.end(), line.begin(),
+                            [](char a, char b) {
+                                return std::tolower(a) == std::tolower(b);
+                            })) {
+                continue;
             }
-        }
 
-        if(data == "Too many requests, please try again later.") {
-            data_j["error"] = "Too many requests, please try again later.";
-        } else 
-        // If the content-length is set and we actually have data
-        if (hasData && data.size() != 0) {
-            if (isJson) {
-                data_j = json::parse(data);
-            } else {
-                // Parse into key-value vector
+            std::string_view value = line.substr(name.size() + 1);
+            std::size_t first = value.find_first_not_of(' ');
+            if (first == std::string_view::npos) {
+                values.push_back("");
+                continue;
             }
+            std::size_t last = value.find_last_not_of(' ');
+            values.push_back(value.substr(first, last - first + 1));
         }
+        return values;
     }
 
-    uint get_response_code() const { return code; }
+    /**
+     * @brief Get the value of a header field
+     * @param name The name of the field (case insensitive)
+     * @return std::string_view The value, without the surrounding spaces
+     * ("" if the field is missing)
+     */
+    std::string_view get_header(std::string_view name) const {
+        std::vector<std::string_view> values = get_headers(name);
+        return values.size() != 0 ? values[0] : "";
+    }
+
+    /**
+     * @brief The header of the response, as it was received
+     */
+    const std::string& get_raw_header() const { return header; }
+
+    /**
+     * @brief Store the cookies set by the response
+     * @param jar The cookie jar
+     * @param host The host of the request
+     * @param path The path of the request
+     */
+    void store_cookies(CookieJar& jar, const std::string& host,
+                       std::string_view path) const {
+        lint now = unix_now();
+        for (auto& line : get_headers("Set-Cookie")) {
+            jar.set_cookie(line, host, path, now);
+        }
+    }
 
-    Cookie& get_session_id() { return session_id; }
+    /**
+     * @brief The raw body of the response, as it was received
+     * @return std::string_view The body (empty if there is none)
+     */
+    std::string_view body_view() const { return data; }
+
+    /**
+     * @brief Get a string field of a JSON body (like the token, or the error
+     * message). The known shapes are read directly from the body; anything
+     * else is left to the json library
+     * @param name The name of the field
+     * @return std::string The value (dumped, if it isn't a string), or "" if
+     * it is missing
+     */
+    std::string get_string(const std::string& name) {
+        std::string value;
+        if (!parsed && has_json && read_string_field(data, name, value)) {
+            return value;
+        }
 
-    json& get_json_data() { return data_j; }
+        json& body = get_json_data();
+        if (!body.is_object() || !body.contains(name)) {
+            return "";
+        }
+
+        json& field = body[name];
+        return field.is_string() ? field.get<std::string>() : field.dump();
+    }
+
+    /**
+     * @brief The body of the response, as json. It is parsed at the first call
+     * @return json& The data (null if the body isn't json)
+     */
+    json& get_json_data() {
+        if (!parsed) {
+            parsed = true;
+
+            if (data == "Too many requests, please try again later.") {
+                data_j["error"] = data;
+            } else if (data.size() != 0 && has_json) {
+                data_j = json::parse(data);
+            }
+        }
+        return data_j;
+    }
 };
\ No newline at end of file
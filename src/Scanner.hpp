@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Utils.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86 1
+#endif
+
+/**
+ * @brief Record the position of a CRLF pair. The header is terminated when
+ * this CRLF follows right after the previous one
+ * @param lines The positions found so far
+ * @param pos The position of the '\r'
+ * @return true This CRLF completes the header terminator
+ * @return false The header continues
+ */
+bool push_crlf(std::vector<size_t>& lines, const size_t pos) {
+    bool terminator = lines.size() != 0 && lines.back() + 2 == pos;
+    lines.push_back(pos);
+    return terminator;
+}
+
+/**
+ * @brief Find the CRLF pairs in [begin, size), one byte at a time
+ * @param data The block
+ * @param begin The offset where the search starts
+ * @param size The size of the block
+ * @param lines The positions of the CRLF pairs found
+ * @return size_t The offset after the header terminator, or npos
+ */
+size_t scan_crlf_scalar(const char* data, size_t begin, const size_t size,
+                        std::vector<size_t>& lines) {
+    for (size_t i = begin; i + 1 < size; i++) {
+        if (data[i] == '\r' && data[i + 1] == '\n' && push_crlf(lines, i)) {
+            return i + 2;
+        }
+    }
+    return std::string::npos;
+}
+
+#ifdef SCANNER_X86
+/**
+ * @brief Find the CRLF pairs in [begin, size), 16 bytes at a time. A CRLF is
+ * a '\r' in a block whose next byte (the same block, shifted by one) is '\n'
+ */
+size_t scan_crlf_sse2(const char* data, size_t begin, const size_t size,
+                      std::vector<size_t>& lines) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    size_t i = begin;
+    for (; i + 17 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 1));
+        uint mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf)));
+
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (push_crlf(lines, pos)) {
+                return pos + 2;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return scan_crlf_scalar(data, i, size, lines);
+}
+
+/**
+ * @brief Find the CRLF pairs in [begin, size), 32 bytes at a time
+ */
+__attribute__((target("avx2"))) size_t scan_crlf_avx2(
+    const char* data, size_t begin, const size_t size,
+    std::vector<size_t>& lines) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    size_t i = begin;
+    for (; i + 33 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + i + 1));
+        uint mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf)));
+
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (push_crlf(lines, pos)) {
+                return pos + 2;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return scan_crlf_sse2(data, i, size, lines);
+}
+#endif
+
+using crlf_scanner = size_t (*)(const char*, size_t, size_t,
+                                std::vector<size_t>&);
+
+/**
+ * @brief Pick the widest CRLF scanner the CPU supports. This is done only
+ * once, at the first call
+ * @return crlf_scanner The scanner
+ */
+crlf_scanner get_crlf_scanner() {
+#ifdef SCANNER_X86
+    static const crlf_scanner scanner = __builtin_cpu_supports("avx2")
+                                            ? scan_crlf_avx2
+                                            : scan_crlf_sse2;
+#else
+    static const crlf_scanner scanner = scan_crlf_scalar;
+#endif
+    return scanner;
+}
+
+/**
+ * @brief Index the lines of a HTTP/1.1 header. The positions of all the CRLF
+ * pairs, up to (and including) the ones of the header terminator, are
+ * appended to lines. The block can be indexed incrementally, as it grows,
+ * by passing the size it had at the previous call
+ * @param data The block (the start of a response)
+ * @param size The size of the block
+ * @param lines The positions of the CRLF pairs found
+ * @param scanned How many bytes of the block were already indexed
+ * @return size_t The offset where the body starts, or npos if the header
+ * isn't complete yet
+ */
+size_t index_header(const char* data, const size_t size,
+                    std::vector<size_t>& lines, const size_t scanned = 0) {
+    // A '\r' on the last byte that was indexed couldn't have been matched
+    size_t begin = scanned != 0 ? scanned - 1 : 0;
+    return get_crlf_scanner()(data, begin, size, lines);
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Utils.hpp"
+
+/**
+ * @brief Coalesces identical calls that are in flight at the same time: the
+ * first caller of a key makes the call, and the ones that arrive before it is
+ * done wait for it and share its result. A call that starts after the result
+ * was shared makes a new call, so a result is never older than the call
+ */
+template <typename T>
+class SingleFlight {
+   private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_future<T>> flights;
+
+    void finish(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        flights.erase(key);
+    }
+
+   public:
+    SingleFlight() {}
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+
+    /**
+     * @brief Make a call, or wait for the identical one in flight (from any
+     * thread)
+     * @param key What identifies the call
+     * @param call The call
+     * @param shared Set if the result came from another caller
+     * @return T The result
+     */
+    T run(const std::string& key, const std::function<T()>& call,
+          bool& shared) {
+        std::promise<T> promise;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto it = flights.find(key);
+            if (it != flights.end()) {
+                std::shared_future<T> flight = it->second;
+                lock.unlock();
+                shared = true;
+                return flight.get();
+            }
+            flights.emplace(key, promise.get_future().share());
+        }
+        shared = false;
+
+        // The waiters get the exception too, and the key is freed either way
+        try {
+            T result = call();
+            finish(key);
+            promise.set_value(result);
+            return result;
+        } catch (...) {
+            finish(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    T run(const std::string& key, const std::function<T()>& call) {
+        bool shared;
+        return run(key, call, shared);
+    }
+};
@@ -0,0 +1,290 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Book.hpp"
+#include "BookTable.hpp"
+#include "Utils.hpp"
+
+#define SNAPSHOT_MAGIC "RCPPLIB"
+#define SNAPSHOT_VERSION 1
+
+/**
+ * @brief The start of a snapshot file. It is followed by the records, and
+ * then by the string heap
+ */
+struct SnapshotHeader {
+    char magic[8];
+    uint version;
+    uint count;
+    lint heap_size;
+    lint checksum;  // Of everything after the header
+    uint owner_offset;
+    uint owner_length;
+};
+
+/**
+ * @brief A string stored in the heap of a snapshot
+ */
+struct SnapshotString {
+    uint offset;
+    uint length;
+};
+
+/**
+ * @brief A book, as it is stored in a snapshot (fixed width)
+ */
+struct SnapshotRecord {
+    lint id;
+    lint page_count;
+    SnapshotString title;
+    SnapshotString author;
+    SnapshotString genre;
+    SnapshotString publisher;
+    uint has_details;
+    uint padding;
+};
+
+/**
+ * @brief FNV-1a hash, used as the checksum of the snapshots
+ */
+lint fnv1a(const char* data, const size_t size,
+           lint hash = 0xcbf29ce484222325ULL) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (uchar)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Write a snapshot of a library. The file is replaced atomically, and
+ * only its owner can read it
+ * @param path The file
+ * @param owner The user the library belongs to
+ * @param listing The books
+ * @param details The full information known about some of the books
+ * @return true The snapshot was written
+ */
+bool write_snapshot(const std::string& path, const std::string& owner,
+                    const BookTable& listing,
+                    const std::unordered_map<lint, Book>& details) {
+    std::string heap;
+    auto store = [&](std::string_view value) {
+        SnapshotString stored;
+        stored.offset = heap.size();
+        stored.length = value.size();
+        heap.append(value);
+        return stored;
+    };
+
+    std::vector<SnapshotRecord> records(listing.size());
+    for (size_t row = 0; row < listing.size(); row++) {
+        SnapshotRecord& record = records[row];
+        bzero(&record, sizeof(record));
+        record.id = listing.id(row);
+        record.title = store(listing.title(row));
+
+        auto it = details.find(record.id);
+        if (it != details.end()) {
+            record.page_count = it->second.page_count;
+            record.author = store(it->second.author);
+            record.genre = store(it->second.genre);
+            record.publisher = store(it->second.publisher);
+            record.has_details = 1;
+        }
+    }
+
+    SnapshotHeader header;
+    bzero(&header, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.count = records.size();
+    SnapshotString stored_owner = store(owner);
+    header.owner_offset = stored_owner.offset;
+    header.owner_length = stored_owner.length;
+    header.heap_size = heap.size();
+
+    const char* data = (const char*)records.data();
+    size_t data_size = records.size() * sizeof(SnapshotRecord);
+    header.checksum = fnv1a(heap.data(), heap.size(), fnv1a(data, data_size));
+
+    std::string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool written = write(fd, &header, sizeof(header)) == sizeof(header) &&
+                   write(fd, data, data_size) == (ssize_t)data_size &&
+                   write(fd, heap.data(), heap.size()) == (ssize_t)heap.size();
+    close(fd);
+
+    if (!written || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief A snapshot of a library, mapped in memory. Nothing is copied when
+ * it is opened, so it can be used right away, whatever its size
+ */
+class Snapshot {
+   private:
+    const char* map;
+    size_t map_size;
+    const SnapshotHeader* header;
+    const SnapshotRecord* records;
+    const char* heap;
+
+    std::string_view get(const SnapshotString& stored) const {
+        return std::string_view(heap + stored.offset, stored.length);
+    }
+
+   public:
+    Snapshot() : map(nullptr), map_size(0) {}
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    /**
+     * @brief Map a snapshot file, and check it. Like the saved credentials, a
+     * file that another user owns, or could read, isn't used
+     * @param path The file
+     * @return true The snapshot is valid (and of a known version)
+     */
+    bool open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) ||
+            info.st_uid != getuid() || (info.st_mode & 077) != 0 ||
+            (size_t)info.st_size < sizeof(*header)) {
+            close(fd);
+            return false;
+        }
+
+        void* mapped =
+            mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        map = (const char*)mapped;
+        map_size = info.st_size;
+        header = (const SnapshotHeader*)map;
+        records = (const SnapshotRecord*)(map + sizeof(*header));
+
+        // Each part is checked against the bytes that are left, so the sizes
+        // can't wrap around
+        size_t left = map_size - sizeof(*header);
+        size_t data_size = (size_t)header->count * sizeof(SnapshotRecord);
+        bool valid =
+            memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) ==
+                0 &&
+            header->version == SNAPSHOT_VERSION &&
+            header->count <= left / sizeof(SnapshotRecord) &&
+            header->heap_size == left - data_size;
+
+        if (valid) {
+            heap = (const char*)(records + header->count);
+            valid = header->checksum ==
+                    fnv1a(heap, header->heap_size,
+                          fnv1a((const char*)records, data_size));
+        }
+
+        // The strings must be inside the heap
+        for (uint i = 0; valid && i < header->count; i++) {
+            for (auto stored : {records[i].title, records[i].author,
+                                records[i].genre, records[i].publisher}) {
+                valid = valid && (lint)stored.offset + stored.length <=
+                                     header->heap_size;
+            }
+        }
+        valid = valid && (lint)header->owner_offset + header->owner_length <=
+                             header->heap_size;
+
+        if (!valid) {
+            unmap();
+        }
+        return valid;
+    }
+
+    void unmap() {
+        if (map) {
+            munmap((void*)map, map_size);
+            map = nullptr;
+            map_size = 0;
+        }
+    }
+
+    bool is_open() const { return map != nullptr; }
+
+    std::string_view owner() const {
+        return std::string_view(heap + header->owner_offset,
+                                header->owner_length);
+    }
+
+    size_t size() const { return header->count; }
+
+    lint id(const size_t row) const { return records[row].id; }
+
+    std::string_view title(const size_t row) const {
+        return get(records[row].title);
+    }
+
+    /**
+     * @brief Find the full information about a book
+     * @param id The id of the book
+     * @param book Where the book is stored
+     * @return true The book is in the snapshot, with all its details
+     */
+    bool find(const lint id, Book& book) const {
+        for (size_t row = 0; row < size(); row++) {
+            const SnapshotRecord& record = records[row];
+            if (record.id != id || !record.has_details) {
+                continue;
+            }
+
+            book.id = record.id;
+            book.title = get(record.title);
+            book.author = get(record.author);
+            book.genre = get(record.genre);
+            book.publisher = get(record.publisher);
+            book.page_count = record.page_count;
+            return true;
+        }
+        return false;
+    }
+
+    ~Snapshot() { unmap(); }
+};
@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Utils.hpp"
+
+/**
+ * @brief A fixed set of worker threads that run the tasks submitted to it, in
+ * the order they were submitted. A task must not wait for another task of the
+ * same pool, as the pool could be full of waiting tasks
+ */
+class ThreadPool {
+   private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool stopping;
+
+    void work() {
+        FOREVER {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+   public:
+    /**
+     * @brief Start the workers
+     * @param threads The number of workers
+     */
+    ThreadPool(const size_t threads) : stopping(false) {
+        for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Queue a task
+     * @param task The task (any callable without parameters)
+     * @return std::future The result of the task
+     */
+    template <typename F>
+    auto submit(F task) -> std::future<decltype(task())> {
+        using R = decltype(task());
+        auto job = std::make_shared<std::packaged_task<R()>>(std::move(task));
+        std::future<R> result = job->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([job] { (*job)(); });
+        }
+        ready.notify_one();
+        return result;
+    }
+
+    size_t size() const { return workers.size(); }
+
+    /**
+     * @brief Finish the queued tasks and stop the workers
+     */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+};
+
+/**
+ * @brief The pool used for CPU-bound work (one worker per core). It is
+ * created at the first use
+ * @return ThreadPool& The pool
+ */
+ThreadPool& cpu_pool() {
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return pool;
+}
@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) 2020 Grama Nicolae
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Credentials.hpp"
+#include "Utils.hpp"
+
+// How long to wait before trying again, after a refresh failed (in seconds)
+#define REFRESH_RETRY 5
+
+/**
+ * @brief Keeps the token of the library valid, by requesting a new one in the
+ * background shortly before it expires. The requests never wait for a
+ * refresh, unless the token has already expired; then all of them wait for
+ * the same refresh, instead of each starting its own
+ */
+class TokenRefresher {
+   public:
+    /**
+     * @brief Requests a new token with the session of the credentials. It is
+     * called on the background thread
+     * @return true The token (and its expiry) were replaced
+     * @return false The refresh failed
+     */
+    using Fetch = std::function<bool(Credentials&)>;
+
+   private:
+    SharedCredentials& shared;
+    Fetch fetch;
+    lint margin;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // The credentials the schedule was computed for, when they were first
+    // seen, and when a failed refresh can be tried again
+    SharedCredentials::Snapshot tracked;
+    lint received;
+    lint retry_at;
+
+    bool requested;
+    bool refreshing;
+    bool stopping;
+    std::thread worker;
+
+    /**
+     * @brief When the tracked token should be replaced (0 if never)
+     */
+    lint deadline() const {
+        if (tracked->session_id() == "" || tracked->token == "" ||
+            tracked->token_expires == 0) {
+            return 0;
+        }
+
+        // Tokens that live less than twice the margin are replaced halfway
+        lint expires = tracked->token_expires;
+        lint at = expires > margin ? expires - margin : 0;
+        if (expires > received) {
+            at = std::max(at, received + (expires - received) / 2);
+        }
+        return std::max(at, retry_at);
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            SharedCredentials::Snapshot current = shared.load();
+            if (current != tracked) {
+                tracked = current;
+                received = unix_now();
+                retry_at = 0;
+            }
+
+            lint at = margin != 0 ? deadline() : 0;
+            lint now = unix_now();
+            if (!requested && (at == 0 || now < at)) {
+                if (at == 0) {
+                    changed.wait(lock);
+                } else {
+                    changed.wait_for(lock, std::chrono::seconds(at - now));
+                }
+                continue;
+            }
+
+            // The request is made without holding the lock, so the waiting
+            // callers can join it
+            Credentials refreshed = *current;
+            refreshing = true;
+            lock.unlock();
+            bool ok = refreshed.session_id() != "" && fetch(refreshed);
+            lock.lock();
+            refreshing = false;
+            requested = false;
+
+            // Credentials that were replaced meanwhile are newer, so they
+            // are kept
+            if (ok) {
+                shared.replace(current, refreshed);
+            } else {
+                retry_at = unix_now() + REFRESH_RETRY;
+            }
+            changed.notify_all();
+        }
+    }
+
+   public:
+    /**
+     * @brief Start the background thread
+     * @param shared The credentials that are kept valid
+     * @param fetch Requests a new token
+     * @param margin How many seconds before the expiry the token is replaced
+     * (0 to only replace tokens that have already expired)
+     */
+    TokenRefresher(SharedCredentials& shared, Fetch fetch, const lint margin)
+        : shared(shared),
+          fetch(fetch),
+          margin(margin),
+          received(0),
+          retry_at(0),
+          requested(false),
+          refreshing(false),
+          stopping(false) {
+        tracked = shared.load();
+        worker = std::thread([this] { work(); });
+    }
+
+    TokenRefresher(const TokenRefresher&) = delete;
+    TokenRefresher& operator=(const TokenRefresher&) = delete;
+
+    /**
+     * @brief Reschedule the refresh, after the credentials were replaced
+     */
+    void update() {
+        {
+            // The worker is either waiting, or hasn't looked at the
+            // credentials yet, so the notification isn't lost
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+        changed.notify_all();
+    }
+
+    /**
+     * @brief Get credentials with a token that hasn't expired. If the token
+     * has expired, the caller waits for the refresh that is in flight (or
+     * for a new one); if the refresh fails, the expired token is returned
+     * @return SharedCredentials::Snapshot The credentials
+     */
+    SharedCredentials::Snapshot get_valid() {
+        SharedCredentials::Snapshot current = shared.load();
+        if (current->session_id() == "" || current->token == "" ||
+            current->token_expires == 0 ||
+            unix_now() < current->token_expires) {
+            return current;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        requested = true;
+        changed.notify_all();
+        changed.wait(lock, [&] {
+            return stopping || shared.load() != current ||
+                   (!requested && !refreshing);
+        });
+        return shared.load();
+    }
+
+    /**
+     * @brief Stop the background thread (a refresh in flight is finished)
+     */
+    ~TokenRefresher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        worker.join();
+    }
+};
@@ -27,17 +27,35 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <queue>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "../lib/json.hpp"
 
 using json = nlohmann::json;
 
+// Consumes a chunk of a message body, as it is received
+using BodyHandler = std::function<void(const char *, size_t)>;
+
 #define lint uint64_t  // Long Int
 #define uint uint32_t  // Unsigned Int
 #define sint uint16_t  // Short Int
@@ -53,6 +71,71 @@ using json = nlohmann::json;
 #define BUFLEN 8192     // Response buffer size
 #define HIDE_PASS false // Hide password input
 
+// Listings bigger than this (in bytes) are buffered and parsed on all the
+// cores, instead of being streamed (0 disables the parallel parsing)
+#define PARALLEL_PARSE_THRESHOLD (16 << 20)
+
+// Memory used by the cache of GET responses, in bytes (0 disables it)
+#define CACHE_BUDGET (64 << 20)
+
+// The longest a cached response is kept fresh, in seconds, whatever its
+// max-age says (a year)
+#define MAX_CACHE_AGE 31536000
+
+// For how many seconds the local copy of the library can answer the reads,
+// without asking the server (0 disables it)
+#define LIBRARY_TTL 30
+
+// The login and the token of the library are saved in files with this prefix,
+// followed by the host and the port, and reused by the next run ("" disables
+// them). They are only saved if the build asks for it (make CREDENTIALS=...)
+#ifndef CREDENTIALS_FILE
+#define CREDENTIALS_FILE ""
+#endif
+
+// How many requests the bulk commands keep in flight, each on its own
+// connection
+#define BULK_CONCURRENCY 16
+
+// The largest in-flight window a bulk command can ask for
+#define MAX_BULK_CONCURRENCY 256
+
+// How many ids a list (of get_book_batch, for example) can have, ranges
+// included
+#define MAX_ID_LIST 100000
+
+// The cookie that holds the session of the user
+#define SESSION_COOKIE "connect.sid"
+
+// How many seconds before its expiry the token of the library is replaced, in
+// the background (0 only replaces the tokens that have already expired)
+#define TOKEN_REFRESH_MARGIN 60
+
+// The snapshots of the library are saved in files with this prefix, followed
+// by the host and the port ("" disables them). They are only saved if the
+// build asks for it (make SNAPSHOT=...)
+#ifndef SNAPSHOT_FILE
+#define SNAPSHOT_FILE ""
+#endif
+
+// The progress of a bulk job is journaled in a file next to its input, with
+// this suffix, so an interrupted job can be resumed ("" disables it)
+#define JOURNAL_SUFFIX ".journal"
+
+// The exports are written in blocks of this size
+#define EXPORT_BUFFER (1 << 20)
+
+// The daemon of a server listens on a UNIX socket with this prefix, followed
+// by the host and the port; the batches are sent to it while it runs (""
+// disables it)
+#define DAEMON_SOCKET ".restcpp_daemon"
+
+// For how many seconds the daemon waits for the script of a client
+#define DAEMON_TIMEOUT 5
+
+// For how many seconds the proxy keeps the connection of an idle client
+#define PROXY_TIMEOUT 60
+
 /**
  * @brief Check if the condition is met. If it doesn't, print message and exit
  */
@@ -75,34 +158,162 @@ using json = nlohmann::json;
  * @brief DNS Lookup to find the associated to the hostname
  * @param hostname The hostname
  * @param port The port
- * @return in_addr The address of the host
+ * @param ip Where the IPv4 address of the host is stored
+ * @return true The host was found
+ * @return false It wasn't
  */
-in_addr getIpFromHostname(std::string hostname, int port) {
-    addrinfo *res;
+bool resolve_host(const std::string &hostname, const int port, in_addr &ip) {
+    addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
     std::string service = std::to_string(port);
 
-    getaddrinfo(hostname.c_str(), service.c_str(), nullptr, &res);
-    MUST(res->ai_family == AF_INET, "Invalid ip adress!\n");
-
-    sockaddr_in addr = *(sockaddr_in *)res->ai_addr;
+    if (getaddrinfo(hostname.c_str(), service.c_str(), &hints, &res) != 0) {
+        return false;
+    }
+    ip = ((sockaddr_in *)res->ai_addr)->sin_addr;
     freeaddrinfo(res);
-    return addr.sin_addr;
+    return true;
+}
+
+/**
+ * @brief Write a whole buffer on a socket
+ * @return true Everything was written
+ * @return false The peer went away
+ */
+bool send_all(const int fd, const char *data, size_t size) {
+    while (size != 0) {
+        ssize_t bytes = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            return false;
+        }
+        data += bytes;
+        size -= bytes;
+    }
+    return true;
 }
 
 /**
- * @brief Check if the string is a positive integer
- * @param s A string
- * @return true The string represents a positive integer
- * @return false The string doesn't represent a positive integer
+ * @brief Parse an unsigned decimal field of a message (a status code, a
+ * Content-Length, an id...). Surrounding spaces are ignored, but anything
+ * else, or a value that doesn't fit in the type, makes the field invalid
+ * @param field The field
+ * @param value Where the number is stored
+ * @return true The field is a valid number
+ * @return false The field is malformed or the number overflows
  */
-bool is_uint(const std::string &s) {
-    std::size_t found = s.find_first_not_of("0123456789");
-    if (found != std::string::npos) {
+template <typename T>
+bool parse_uint_field(std::string_view field, T &value) {
+    std::size_t first = field.find_first_not_of(' ');
+    std::size_t last = field.find_last_not_of(' ');
+    if (first == std::string_view::npos) {
+        return false;
+    }
+
+    const char *begin = field.data() + first;
+    const char *end = field.data() + last + 1;
+
+    // from_chars would accept a sign for signed types
+    if (*begin < '0' || *begin > '9') {
+        return false;
+    }
+
+    T result;
+    auto parsed = std::from_chars(begin, end, result);
+    if (parsed.ec != std::errc() || parsed.ptr != end) {
         return false;
     }
+
+    value = result;
     return true;
 }
 
+/**
+ * @brief The current time, in seconds since the epoch
+ */
+lint unix_now() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Lowercase a string
+ */
+std::string to_lower(std::string_view text) {
+    std::string lower(text);
+    std::transform(lower.begin(), lower.end(), lower.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return lower;
+}
+
+/**
+ * @brief Remove the spaces and tabs around a string
+ */
+std::string_view trim_spaces(std::string_view text) {
+    std::size_t first = text.find_first_not_of(" \t");
+    if (first == std::string_view::npos) {
+        return "";
+    }
+    std::size_t last = text.find_last_not_of(" \t");
+    return text.substr(first, last - first + 1);
+}
+
+/**
+ * @brief Check the extension of a file (ignoring the case)
+ * @param path The file
+ * @param extension The extension, with its dot
+ */
+bool has_extension(std::string_view path, std::string_view extension) {
+    return path.size() >= extension.size() &&
+           to_lower(path.substr(path.size() - extension.size())) == extension;
+}
+
+/**
+ * @brief Parse a list of ids, like "1 2, 5-10". The ids are separated by
+ * spaces or commas, and a range includes both of its ends. The list can't
+ * have more than MAX_ID_LIST ids
+ * @param text The list
+ * @param ids Where the ids are appended, in the order they are listed
+ * @return true The list is valid
+ * @return false An id or a range is malformed, or the list is too long
+ */
+bool parse_id_list(std::string_view text, std::vector<uint> &ids) {
+    std::size_t pos = 0;
+    FOREVER {
+        pos = text.find_first_not_of(" ,\t", pos);
+        if (pos == std::string_view::npos) {
+            return true;
+        }
+        std::size_t end = text.find_first_of(" ,\t", pos);
+        std::string_view item = text.substr(pos, end - pos);
+        pos = end;
+
+        std::size_t dash = item.find('-');
+        uint first, last;
+        if (dash == std::string_view::npos) {
+            if (!parse_uint_field(item, first) ||
+                ids.size() >= MAX_ID_LIST) {
+                return false;
+            }
+            ids.push_back(first);
+        } else if (parse_uint_field(item.substr(0, dash), first) &&
+                   parse_uint_field(item.substr(dash + 1), last) &&
+                   first <= last &&
+                   (lint)last - first < MAX_ID_LIST - ids.size()) {
+            for (lint id = first; id <= last; id++) {
+                ids.push_back(id);
+            }
+        } else {
+            return false;
+        }
+    }
+}
+
 /**
  * @brief A simple way to disting good http response codes (2xx) from
  * bad ones (4xx, 5xx)